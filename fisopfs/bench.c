@@ -0,0 +1,214 @@
+#define _GNU_SOURCE
+#include "fs.h"
+
+#define BENCH_FILE_DISK "bench.fisopfs"
+#define BENCH_DEFAULT_FILES 100000
+#define BENCH_DIRS 100 // Files are spread over this many directories
+#define BENCH_DATA "0123456789abcdef" // Written to every file
+#define NS_PER_SEC 1000000000.0
+#define BYTES_PER_MB (1024.0 * 1024.0)
+#define BENCH_COPY_SIZE (64 * 1024) // Size of each file of the copies phases
+#define BENCH_COPY_RATIO 100 // One copy for every this many files
+
+// Benchmark of the filesystem core without FUSE: how creating, looking up,
+// saving, loading, reading and removing scale with the amount of files,
+// and what compressing the image and deduplicating blocks change.
+
+static double
+now()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / NS_PER_SEC;
+}
+
+static double
+report(const char *phase, double start, int ops)
+{
+	double elapsed = now() - start;
+	printf("%-14s %10d ops %10.1f ms %10.0f ns/op\n",
+	       phase,
+	       ops,
+	       elapsed * 1000,
+	       elapsed * NS_PER_SEC / ops);
+	return elapsed;
+}
+
+static void
+file_path(char *out, size_t len, int i)
+{
+	snprintf(out, len, "/d%d/f%d", i % BENCH_DIRS, i);
+}
+
+// Checkpoint, load and read back every file, with suffix after the name
+// of each phase. Returns the size of the image, or -1.
+static off_t
+save_and_load(int files, const char *suffix, double *save, double *load)
+{
+	char path[MAX_PATH_NAME];
+	char phase[MAX_PATH_NAME];
+	double start = now();
+	if (fs_checkpoint(BENCH_FILE_DISK) != EXIT_SUCCESS) {
+		return -1;
+	}
+	snprintf(phase, sizeof(phase), "checkpoint%s", suffix);
+	*save = report(phase, start, files);
+	struct stat st;
+	if (stat(BENCH_FILE_DISK, &st) != 0) {
+		return -1;
+	}
+
+	start = now();
+	if (fs_deserialize(BENCH_FILE_DISK) != EXIT_SUCCESS) {
+		return -1;
+	}
+	snprintf(phase, sizeof(phase), "load%s", suffix);
+	*load = report(phase, start, files);
+
+	// Loading leaves the contents in the image, the first read loads them
+	char buffer[sizeof(BENCH_DATA)];
+	start = now();
+	for (int i = 0; i < files; i++) {
+		file_path(path, sizeof(path), i);
+		if (fs_read_data(fs_lookup(path), buffer, sizeof(buffer), 0) !=
+		    sizeof(buffer)) {
+			fprintf(stderr, "read %s falló\n", path);
+			return -1;
+		}
+	}
+	snprintf(phase, sizeof(phase), "read%s", suffix);
+	*load += report(phase, start, files);
+	return st.st_size;
+}
+
+// Write copies files with the same contents into a new filesystem, with
+// or without --dedup, then flush and save it. Returns the size of the
+// image, or -1, and leaves the blocks in use in *used.
+static off_t
+write_copies(int copies, bool dedup, const char *phase, size_t *used)
+{
+	static char content[BENCH_COPY_SIZE];
+	for (size_t k = 0; k < sizeof(content); k++) {
+		content[k] = BENCH_DATA[(k * k + k / FS_BLOCK_SIZE) % (sizeof(BENCH_DATA) - 1)];
+	}
+	fs_set_dedup(dedup);
+	if (fs_create(BENCH_FILE_DISK) != EXIT_SUCCESS) {
+		return -1;
+	}
+	char path[MAX_PATH_NAME];
+	double start = now();
+	for (int i = 0; i < copies; i++) {
+		snprintf(path, sizeof(path), "/c%d", i);
+		int index = fs_create_entry(path, 0644, FILE_TYPE);
+		if (index < 0 ||
+		    fs_write_data(index, content, sizeof(content), 0) != sizeof(content)) {
+			fprintf(stderr, "copy %s falló\n", path);
+			return -1;
+		}
+	}
+	if (fs_flush(BENCH_FILE_DISK) != EXIT_SUCCESS) {
+		return -1;
+	}
+	report(phase, start, copies);
+	*used = blocks_used();
+	struct stat st;
+	if (fs_checkpoint(BENCH_FILE_DISK) != EXIT_SUCCESS ||
+	    stat(BENCH_FILE_DISK, &st) != 0) {
+		return -1;
+	}
+	return st.st_size;
+}
+
+int
+main(int argc, char *argv[])
+{
+	int files = argc > 1 ? atoi(argv[1]) : BENCH_DEFAULT_FILES;
+	char path[MAX_PATH_NAME];
+	if (files <= 0 || files + BENCH_DIRS >= MAX_INODES) {
+		fprintf(stderr, "uso: %s [cantidad de archivos]\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+	if (fs_initialize() != EXIT_SUCCESS) {
+		return EXIT_FAILURE;
+	}
+	for (int d = 0; d < BENCH_DIRS; d++) {
+		snprintf(path, sizeof(path), "/d%d", d);
+		fs_create_entry(path, 0755, DIR_TYPE);
+	}
+
+	double start = now();
+	for (int i = 0; i < files; i++) {
+		file_path(path, sizeof(path), i);
+		if (fs_create_entry(path, 0644, FILE_TYPE) < 0) {
+			fprintf(stderr, "create %s falló\n", path);
+			return EXIT_FAILURE;
+		}
+	}
+	report("create", start, files);
+
+	start = now();
+	for (int i = 0; i < files; i++) {
+		file_path(path, sizeof(path), i);
+		fs_write_data(fs_lookup(path), BENCH_DATA, sizeof(BENCH_DATA), 0);
+	}
+	report("write", start, files);
+
+	start = now();
+	for (int i = 0; i < files; i++) {
+		file_path(path, sizeof(path), (int) ((i * 7919LL) % files));
+		if (fs_lookup(path) == BAD_INDEX) {
+			fprintf(stderr, "lookup %s falló\n", path);
+			return EXIT_FAILURE;
+		}
+	}
+	report("lookup", start, files);
+
+	double raw_save, raw_load;
+	off_t raw_size = save_and_load(files, "", &raw_save, &raw_load);
+	if (raw_size < 0) {
+		return EXIT_FAILURE;
+	}
+	fs_set_compress(true);
+	double lz_save, lz_load;
+	off_t lz_size = save_and_load(files, "-lz", &lz_save, &lz_load);
+	if (lz_size < 0) {
+		return EXIT_FAILURE;
+	}
+	// Throughput over the bytes of the uncompressed image in both cases
+	printf("image          %10lld bytes raw %10lld bytes lz (ratio %.2f)\n",
+	       (long long) raw_size,
+	       (long long) lz_size,
+	       (double) raw_size / lz_size);
+	printf("checkpoint     %10.1f MB/s raw %10.1f MB/s lz\n",
+	       raw_size / BYTES_PER_MB / raw_save,
+	       raw_size / BYTES_PER_MB / lz_save);
+	printf("load+read      %10.1f MB/s raw %10.1f MB/s lz\n",
+	       raw_size / BYTES_PER_MB / raw_load,
+	       raw_size / BYTES_PER_MB / lz_load);
+
+	start = now();
+	for (int i = 0; i < files; i++) {
+		file_path(path, sizeof(path), i);
+		fs_remove_entry(fs_lookup(path));
+	}
+	report("unlink", start, files);
+
+	int copies = files / BENCH_COPY_RATIO ? files / BENCH_COPY_RATIO : 1;
+	size_t plain_used, dedup_used;
+	fs_set_compress(false);
+	off_t plain_size = write_copies(copies, false, "copies", &plain_used);
+	off_t dedup_size = write_copies(copies, true, "copies-dedup", &dedup_used);
+	if (plain_size < 0 || dedup_size < 0) {
+		return EXIT_FAILURE;
+	}
+	printf("copies-blocks  %10zu in use %10zu in use dedup\n", plain_used, dedup_used);
+	printf("copies-image   %10lld bytes   %10lld bytes dedup\n",
+	       (long long) plain_size,
+	       (long long) dedup_size);
+
+	char journal[MAX_PATH_NAME];
+	snprintf(journal, sizeof(journal), "%s%s", BENCH_FILE_DISK, JOURNAL_SUFFIX);
+	unlink(BENCH_FILE_DISK);
+	unlink(journal);
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,100 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <fcntl.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#define BENCH_DIR "bench_mount" // Created inside the mount point
+#define BENCH_DEFAULT_FILES 1000
+#define BENCH_ROUNDS 10 // Times every path is looked at
+#define MAX_PATH_NAME 256
+#define NS_PER_SEC 1000000000.0
+
+// Benchmark of a mounted fisopfs: how long stat takes on the same paths
+// over and over, which is what the caching options change. Mounting with
+// different -o entry_timeout, attr_timeout and negative_timeout and
+// running it on each shows what the kernel cache saves.
+
+static double
+now()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / NS_PER_SEC;
+}
+
+static void
+report(const char *phase, double start, int ops)
+{
+	double elapsed = now() - start;
+	printf("%-12s %10d ops %10.1f ms %10.0f ns/op\n",
+	       phase,
+	       ops,
+	       elapsed * 1000,
+	       elapsed * NS_PER_SEC / ops);
+}
+
+// Stat every file (or a missing name next to it) rounds times
+static int
+stat_all(const char *dir, int files, int rounds, bool missing)
+{
+	char path[MAX_PATH_NAME * 2];
+	struct stat st;
+	for (int r = 0; r < rounds; r++) {
+		for (int i = 0; i < files; i++) {
+			snprintf(path, sizeof(path), "%s/%s%d", dir, missing ? "x" : "f", i);
+			if ((stat(path, &st) == 0) == missing) {
+				fprintf(stderr, "stat %s: %s\n", path, strerror(errno));
+				return EXIT_FAILURE;
+			}
+		}
+	}
+	return EXIT_SUCCESS;
+}
+
+int
+main(int argc, char *argv[])
+{
+	int files = argc > 2 ? atoi(argv[2]) : BENCH_DEFAULT_FILES;
+	if (argc < 2 || files <= 0) {
+		fprintf(stderr, "uso: %s <punto de montaje> [cantidad de archivos]\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+	char dir[MAX_PATH_NAME], path[MAX_PATH_NAME * 2];
+	snprintf(dir, sizeof(dir), "%s/%s", argv[1], BENCH_DIR);
+	if (mkdir(dir, 0755) != 0) {
+		fprintf(stderr, "mkdir %s: %s\n", dir, strerror(errno));
+		return EXIT_FAILURE;
+	}
+	for (int i = 0; i < files; i++) {
+		snprintf(path, sizeof(path), "%s/f%d", dir, i);
+		int fd = open(path, O_CREAT | O_WRONLY, 0644);
+		if (fd < 0) {
+			fprintf(stderr, "create %s: %s\n", path, strerror(errno));
+			return EXIT_FAILURE;
+		}
+		close(fd);
+	}
+
+	double start = now();
+	int res = stat_all(dir, files, 1, false);
+	report("stat first", start, files);
+	start = now();
+	res |= stat_all(dir, files, BENCH_ROUNDS, false);
+	report("stat again", start, files * BENCH_ROUNDS);
+	start = now();
+	res |= stat_all(dir, files, BENCH_ROUNDS, true);
+	report("stat missing", start, files * BENCH_ROUNDS);
+
+	for (int i = 0; i < files; i++) {
+		snprintf(path, sizeof(path), "%s/f%d", dir, i);
+		unlink(path);
+	}
+	rmdir(dir);
+	return res;
+}
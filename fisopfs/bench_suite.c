@@ -0,0 +1,451 @@
+#define _GNU_SOURCE
+#include <dirent.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdbool.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+
+#define BENCH_DEFAULT_FILES 1000
+#define BENCH_TMP_TEMPLATE "/tmp/fisopfs_bench.XXXXXX"
+#define BENCH_DISK "disk.fisopfs" // Image, inside the temporary directory
+#define BENCH_MOUNT "mnt" // Mount point, inside the temporary directory
+#define BENCH_DEPTH 4 // Directories above the file of the deep lookups, MAX_DEPTH of fisopfs
+#define BENCH_READDIR_ROUNDS 20 // Times the full directory is listed
+#define BENCH_IO_FILE_SIZE (16 << 20) // Bytes of the file read and written
+#define BENCH_SYNCS 100 // Writes followed by fsync
+#define BENCH_REMOUNTS 5 // Unmount and mount cycles
+#define BENCH_SEED 42 // Random offsets are the same on every run
+#define MOUNT_TIMEOUT 10.0 // Seconds to wait for fisopfs to mount
+#define MOUNT_POLL_US 1000 // Between checks of whether it mounted
+#define FUSERMOUNT "fusermount"
+#define MAX_ARGS 64
+#define MAX_PATH_NAME 256
+#define NS_PER_SEC 1000000000.0
+
+// Benchmark suite of a mounted fisopfs: mounts it on a temporary directory
+// and times create, stat and unlink storms, deep path lookups, listing a
+// full directory, sequential and random reads and writes of several sizes,
+// fsync, and unmount/mount cycles (checkpoint and load). Reports ops/s and
+// p50/p99 latency of each workload, as CSV with --csv.
+
+static const size_t io_sizes[] = { 4096, 65536, 1 << 20 };
+
+static bool csv;
+static char tmp_dir[] = BENCH_TMP_TEMPLATE;
+static char mount_point[MAX_PATH_NAME];
+static char disk[MAX_PATH_NAME];
+static pid_t fisopfs_pid = -1;
+
+// Latency of each operation of a workload
+typedef struct samples {
+	double *ns;
+	int amount;
+	double start;
+} samples_t;
+
+static double
+now()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / NS_PER_SEC;
+}
+
+static int
+compare_ns(const void *a, const void *b)
+{
+	double x = *(const double *) a, y = *(const double *) b;
+	return (x > y) - (x < y);
+}
+
+// Start timing a workload of at most ops operations
+static void
+samples_begin(samples_t *s, int ops)
+{
+	s->ns = malloc(ops * sizeof(double));
+	s->amount = 0;
+	s->start = now();
+	if (s->ns == NULL) {
+		perror("malloc");
+		exit(EXIT_FAILURE);
+	}
+}
+
+// Record an operation that started at start
+static void
+samples_add(samples_t *s, double start)
+{
+	s->ns[s->amount++] = (now() - start) * NS_PER_SEC;
+}
+
+// Print the throughput and latency percentiles of a finished workload
+static void
+report(const char *workload, samples_t *s)
+{
+	double elapsed = now() - s->start;
+	if (s->amount == 0) {
+		free(s->ns);
+		return;
+	}
+	qsort(s->ns, s->amount, sizeof(double), compare_ns);
+	double p50 = s->ns[s->amount / 2];
+	double p99 = s->ns[(int) (s->amount * 0.99)];
+	printf(csv ? "%s,%d,%.0f,%.0f,%.0f\n"
+	           : "%-18s %8d ops %12.0f ops/s  p50 %10.0f ns  p99 %10.0f ns\n",
+	       workload,
+	       s->amount,
+	       s->amount / elapsed,
+	       p50,
+	       p99);
+	free(s->ns);
+}
+
+// Remove the image and everything fisopfs leaves next to it
+static void
+cleanup()
+{
+	static const char *suffixes[] = { "", ".journal", ".journal.old", ".tmp", ".blocks" };
+	char path[MAX_PATH_NAME * 2];
+	for (size_t i = 0; i < sizeof(suffixes) / sizeof(suffixes[0]); i++) {
+		snprintf(path, sizeof(path), "%s%s", disk, suffixes[i]);
+		unlink(path);
+	}
+	rmdir(mount_point);
+	rmdir(tmp_dir);
+}
+
+// Whether fisopfs is mounted on mount_point, its device differs from the
+// one of the directory that holds it
+static bool
+mounted()
+{
+	struct stat parent, mount;
+	return stat(tmp_dir, &parent) == 0 && stat(mount_point, &mount) == 0 &&
+	       parent.st_dev != mount.st_dev;
+}
+
+// Run fisopfs in the foreground with the options in args and wait until
+// it is mounted
+static void
+mount_fisopfs(const char *binary, char *options[], int options_amount)
+{
+	char *args[MAX_ARGS];
+	int n = 0;
+	args[n++] = (char *) binary;
+	args[n++] = mount_point;
+	args[n++] = "-f";
+	args[n++] = "--filedisk";
+	args[n++] = disk;
+	for (int i = 0; i < options_amount && n < MAX_ARGS - 1; i++) {
+		args[n++] = options[i];
+	}
+	args[n] = NULL;
+	fisopfs_pid = fork();
+	if (fisopfs_pid == 0) {
+		execv(binary, args);
+		_exit(EXIT_FAILURE);
+	}
+	double deadline = now() + MOUNT_TIMEOUT;
+	while (!mounted()) {
+		if (fisopfs_pid < 0 || waitpid(fisopfs_pid, NULL, WNOHANG) != 0 ||
+		    now() > deadline) {
+			fprintf(stderr, "no se pudo montar %s en %s\n", binary, mount_point);
+			if (fisopfs_pid > 0) {
+				kill(fisopfs_pid, SIGTERM);
+				waitpid(fisopfs_pid, NULL, 0);
+			}
+			cleanup();
+			exit(EXIT_FAILURE);
+		}
+		usleep(MOUNT_POLL_US);
+	}
+}
+
+// Unmount and wait for fisopfs to exit, after its last checkpoint
+static void
+unmount_fisopfs()
+{
+	pid_t pid = fork();
+	if (pid == 0) {
+		execlp(FUSERMOUNT, FUSERMOUNT, "-u", mount_point, (char *) NULL);
+		_exit(EXIT_FAILURE);
+	}
+	int status;
+	if (pid < 0 || waitpid(pid, &status, 0) < 0 || !WIFEXITED(status) ||
+	    WEXITSTATUS(status) != 0) {
+		fprintf(stderr, "no se pudo desmontar %s\n", mount_point);
+		kill(fisopfs_pid, SIGTERM);
+	}
+	waitpid(fisopfs_pid, NULL, 0);
+	fisopfs_pid = -1;
+}
+
+// Report what failed and leave nothing mounted or behind
+static void
+fail(const char *what, const char *path)
+{
+	fprintf(stderr, "%s %s: %s\n", what, path, strerror(errno));
+	if (fisopfs_pid > 0) {
+		unmount_fisopfs();
+	}
+	cleanup();
+	exit(EXIT_FAILURE);
+}
+
+static void
+file_path(char *out, size_t len, int i)
+{
+	snprintf(out, len, "%s/f%d", mount_point, i);
+}
+
+static void
+create_storm(int files)
+{
+	char path[MAX_PATH_NAME * 2];
+	samples_t s;
+	samples_begin(&s, files);
+	for (int i = 0; i < files; i++) {
+		file_path(path, sizeof(path), i);
+		double start = now();
+		int fd = open(path, O_CREAT | O_WRONLY, 0644);
+		if (fd < 0) {
+			fail("create", path);
+		}
+		close(fd);
+		samples_add(&s, start);
+	}
+	report("create", &s);
+}
+
+static void
+stat_storm(const char *workload, int files)
+{
+	char path[MAX_PATH_NAME * 2];
+	struct stat st;
+	samples_t s;
+	samples_begin(&s, files);
+	for (int i = 0; i < files; i++) {
+		file_path(path, sizeof(path), i);
+		double start = now();
+		if (stat(path, &st) != 0) {
+			fail("stat", path);
+		}
+		samples_add(&s, start);
+	}
+	report(workload, &s);
+}
+
+static void
+unlink_storm(int files)
+{
+	char path[MAX_PATH_NAME * 2];
+	samples_t s;
+	samples_begin(&s, files);
+	for (int i = 0; i < files; i++) {
+		file_path(path, sizeof(path), i);
+		double start = now();
+		if (unlink(path) != 0) {
+			fail("unlink", path);
+		}
+		samples_add(&s, start);
+	}
+	report("unlink", &s);
+}
+
+// List the directory with every file, each listing is an operation
+static void
+readdir_full(int files)
+{
+	samples_t s;
+	samples_begin(&s, BENCH_READDIR_ROUNDS);
+	for (int r = 0; r < BENCH_READDIR_ROUNDS; r++) {
+		double start = now();
+		DIR *dir = opendir(mount_point);
+		if (dir == NULL) {
+			fail("opendir", mount_point);
+		}
+		int entries = 0;
+		while (readdir(dir) != NULL) {
+			entries++;
+		}
+		closedir(dir);
+		if (entries < files) {
+			// Some file is missing from the listing
+			errno = ENOENT;
+			fail("readdir", mount_point);
+		}
+		samples_add(&s, start);
+	}
+	report("readdir", &s);
+}
+
+// Stat a file under BENCH_DEPTH directories over and over
+static void
+deep_lookup(int files)
+{
+	char path[MAX_PATH_NAME * 4];
+	int len = snprintf(path, sizeof(path), "%s", mount_point);
+	for (int d = 0; d < BENCH_DEPTH; d++) {
+		len += snprintf(path + len, sizeof(path) - len, "/d%d", d);
+		if (mkdir(path, 0755) != 0) {
+			fail("mkdir", path);
+		}
+	}
+	snprintf(path + len, sizeof(path) - len, "/leaf");
+	int fd = open(path, O_CREAT | O_WRONLY, 0644);
+	if (fd < 0) {
+		fail("create", path);
+	}
+	close(fd);
+	struct stat st;
+	samples_t s;
+	samples_begin(&s, files);
+	for (int i = 0; i < files; i++) {
+		double start = now();
+		if (stat(path, &st) != 0) {
+			fail("stat", path);
+		}
+		samples_add(&s, start);
+	}
+	report("deep-lookup", &s);
+}
+
+// Write or read a BENCH_IO_FILE_SIZE file size bytes at a time, in order
+// or at random offsets
+static void
+io_workload(const char *name, size_t size, bool write, bool random)
+{
+	char path[MAX_PATH_NAME * 2], workload[MAX_PATH_NAME];
+	snprintf(path, sizeof(path), "%s/io", mount_point);
+	snprintf(workload,
+	         sizeof(workload),
+	         "%s-%s-%zuk",
+	         random ? "rand" : "seq",
+	         name,
+	         size / 1024);
+	char *buffer = malloc(size);
+	int fd = open(path, write ? O_CREAT | O_WRONLY : O_RDONLY, 0644);
+	if (buffer == NULL || fd < 0) {
+		fail("open", path);
+	}
+	memset(buffer, 'x', size);
+	int ops = BENCH_IO_FILE_SIZE / size;
+	unsigned int seed = BENCH_SEED;
+	samples_t s;
+	samples_begin(&s, ops);
+	for (int i = 0; i < ops; i++) {
+		off_t offset = (off_t) (random ? rand_r(&seed) % ops : i) * size;
+		double start = now();
+		ssize_t n = write ? pwrite(fd, buffer, size, offset)
+		                  : pread(fd, buffer, size, offset);
+		if (n != (ssize_t) size) {
+			fail(name, path);
+		}
+		samples_add(&s, start);
+	}
+	close(fd);
+	free(buffer);
+	report(workload, &s);
+}
+
+// Small writes each made durable with fsync
+static void
+fsync_workload()
+{
+	char path[MAX_PATH_NAME * 2];
+	snprintf(path, sizeof(path), "%s/sync", mount_point);
+	int fd = open(path, O_CREAT | O_WRONLY, 0644);
+	if (fd < 0) {
+		fail("open", path);
+	}
+	samples_t s;
+	samples_begin(&s, BENCH_SYNCS);
+	for (int i = 0; i < BENCH_SYNCS; i++) {
+		double start = now();
+		if (pwrite(fd, &i, sizeof(i), (off_t) i * sizeof(i)) != sizeof(i) ||
+		    fsync(fd) != 0) {
+			fail("fsync", path);
+		}
+		samples_add(&s, start);
+	}
+	close(fd);
+	report("write-fsync", &s);
+}
+
+// Unmount, which checkpoints the image, and mount again, which loads it
+static void
+remount_cycles(const char *binary, char *options[], int options_amount)
+{
+	samples_t unmount, mount;
+	samples_begin(&unmount, BENCH_REMOUNTS);
+	samples_begin(&mount, BENCH_REMOUNTS);
+	for (int r = 0; r < BENCH_REMOUNTS; r++) {
+		double start = now();
+		unmount_fisopfs();
+		samples_add(&unmount, start);
+		start = now();
+		mount_fisopfs(binary, options, options_amount);
+		samples_add(&mount, start);
+	}
+	report("unmount", &unmount);
+	report("mount", &mount);
+}
+
+int
+main(int argc, char *argv[])
+{
+	int first = 1;
+	if (argc > first && strcmp(argv[first], "--csv") == 0) {
+		csv = true;
+		first++;
+	}
+	if (argc <= first) {
+		fprintf(stderr,
+		        "uso: %s [--csv] <fisopfs> [cantidad de archivos] [opciones de fisopfs]\n",
+		        argv[0]);
+		return EXIT_FAILURE;
+	}
+	const char *binary = argv[first++];
+	int files = BENCH_DEFAULT_FILES;
+	if (argc > first && atoi(argv[first]) > 0) {
+		files = atoi(argv[first++]);
+	}
+	if (mkdtemp(tmp_dir) == NULL) {
+		fail("mkdtemp", tmp_dir);
+	}
+	snprintf(mount_point, sizeof(mount_point), "%s/%s", tmp_dir, BENCH_MOUNT);
+	snprintf(disk, sizeof(disk), "%s/%s", tmp_dir, BENCH_DISK);
+	if (mkdir(mount_point, 0755) != 0) {
+		fail("mkdir", mount_point);
+	}
+	mount_fisopfs(binary, argv + first, argc - first);
+	if (csv) {
+		printf("workload,ops,ops_per_sec,p50_ns,p99_ns\n");
+	}
+
+	create_storm(files);
+	stat_storm("stat", files);
+	readdir_full(files);
+	deep_lookup(files);
+	for (size_t i = 0; i < sizeof(io_sizes) / sizeof(io_sizes[0]); i++) {
+		io_workload("write", io_sizes[i], true, false);
+		io_workload("read", io_sizes[i], false, false);
+		io_workload("write", io_sizes[i], true, true);
+		io_workload("read", io_sizes[i], false, true);
+	}
+	fsync_workload();
+	remount_cycles(binary, argv + first, argc - first);
+	stat_storm("stat-remounted", files);
+	unlink_storm(files);
+
+	unmount_fisopfs();
+	cleanup();
+	return EXIT_SUCCESS;
+}
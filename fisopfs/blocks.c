@@ -0,0 +1,570 @@
+#define _GNU_SOURCE
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include "blocks.h"
+#include "hash.h"
+
+// Block table indexed by block id, NULL for free ids. block_data reads it
+// without locking, so a table that is outgrown stays allocated until the
+// store is reset: a reader holding it still finds its blocks there.
+static char **blocks;
+static char **old_tables[BLOCKS_MAX_TABLES];
+static size_t old_tables_amount;
+static size_t blocks_capacity;
+static size_t blocks_top = FIRST_BLOCK;
+static size_t blocks_amount;
+
+// Stack of freed ids reused before growing the table
+static block_id_t *free_ids;
+static size_t free_amount;
+
+// Mapped store: block id k lives at offset k * FS_BLOCK_SIZE of the file,
+// inside an address range reserved up front so blocks never move
+static int mapped_fd = -1;
+static char *mapped_base;
+static size_t mapped_slots;
+
+// Blocks of the mapped store written since the last sync
+static unsigned char *dirty;
+static block_id_t *dirty_ids;
+static size_t dirty_amount;
+
+// References to each block, and the references saved by sharing blocks
+static uint32_t *refs;
+static size_t shared_amount;
+
+// Index of block contents for block_dedup: buckets of ids chained through
+// index_next, by the hash of the whole block. A block is only indexed
+// while its contents can't change, block_own takes it out before writing.
+static uint32_t *hashes;
+static block_id_t *index_next;
+static unsigned char *indexed;
+static block_id_t *buckets;
+
+// Guards allocation, freeing and dirty tracking. Loading and resetting the
+// store only happen while no operation is being served.
+static pthread_mutex_t blocks_lock = PTHREAD_MUTEX_INITIALIZER;
+
+// Bucket of the content index for a hash, with capacity buckets
+static size_t
+bucket_of(uint32_t hash, size_t capacity)
+{
+	return hash & (capacity - 1);
+}
+
+// New array of capacity elements of size bytes holding the blocks_capacity
+// elements of array, the rest zeroed. NULL when out of memory.
+static void *
+grown(const void *array, size_t capacity, size_t size)
+{
+	void *copy = calloc(capacity, size);
+	if (copy != NULL && array != NULL) {
+		memcpy(copy, array, blocks_capacity * size);
+	}
+	return copy;
+}
+
+// Take a block out of the content index, with blocks_lock held
+static void
+unindex(block_id_t id)
+{
+	if (!indexed[id]) {
+		return;
+	}
+	block_id_t *link = &buckets[bucket_of(hashes[id], blocks_capacity)];
+	while (*link != id) {
+		link = &index_next[*link];
+	}
+	*link = index_next[id];
+	indexed[id] = 0;
+}
+
+// Grow the block table (and the arrays indexed like it) to fit one more id.
+// Every array is allocated before any of them replaces the current one, so
+// running out of memory leaves the store as it was.
+static int
+grow_table()
+{
+	size_t capacity = blocks_capacity ? blocks_capacity * 2
+	                                  : BLOCKS_INITIAL_CAPACITY;
+	if (old_tables_amount == BLOCKS_MAX_TABLES) {
+		return BLOCKS_ERROR;
+	}
+	char **new_blocks = grown(blocks, capacity, sizeof(char *));
+	block_id_t *new_free = grown(free_ids, capacity, sizeof(block_id_t));
+	block_id_t *new_dirty_ids = grown(dirty_ids, capacity, sizeof(block_id_t));
+	unsigned char *new_dirty = grown(dirty, capacity, 1);
+	uint32_t *new_refs = grown(refs, capacity, sizeof(uint32_t));
+	uint32_t *new_hashes = grown(hashes, capacity, sizeof(uint32_t));
+	block_id_t *new_next = grown(index_next, capacity, sizeof(block_id_t));
+	unsigned char *new_indexed = grown(indexed, capacity, 1);
+	block_id_t *new_buckets = calloc(capacity, sizeof(block_id_t));
+	if (new_blocks == NULL || new_free == NULL || new_dirty_ids == NULL ||
+	    new_dirty == NULL || new_refs == NULL || new_hashes == NULL ||
+	    new_next == NULL || new_indexed == NULL || new_buckets == NULL) {
+		free(new_blocks);
+		free(new_free);
+		free(new_dirty_ids);
+		free(new_dirty);
+		free(new_refs);
+		free(new_hashes);
+		free(new_next);
+		free(new_indexed);
+		free(new_buckets);
+		return BLOCKS_ERROR;
+	}
+	// The content index has as many buckets as ids, its blocks move to
+	// their bucket among the new ones (all NO_BLOCK, calloc'd)
+	for (size_t id = FIRST_BLOCK; id < blocks_top; id++) {
+		if (new_indexed[id]) {
+			size_t bucket = bucket_of(new_hashes[id], capacity);
+			new_next[id] = new_buckets[bucket];
+			new_buckets[bucket] = id;
+		}
+	}
+	if (blocks != NULL) {
+		old_tables[old_tables_amount++] = blocks;
+	}
+	__atomic_store_n(&blocks, new_blocks, __ATOMIC_RELEASE);
+	free(free_ids);
+	free(dirty_ids);
+	free(dirty);
+	free(refs);
+	free(hashes);
+	free(index_next);
+	free(indexed);
+	free(buckets);
+	free_ids = new_free;
+	dirty_ids = new_dirty_ids;
+	dirty = new_dirty;
+	refs = new_refs;
+	hashes = new_hashes;
+	index_next = new_next;
+	indexed = new_indexed;
+	buckets = new_buckets;
+	blocks_capacity = capacity;
+	return 0;
+}
+
+// Extend the mapped file (and its mapping) by BLOCKS_MAP_GROW blocks
+static int
+grow_mapping()
+{
+	size_t slots = mapped_slots + BLOCKS_MAP_GROW;
+	if (slots * FS_BLOCK_SIZE > BLOCKS_MAP_RESERVE ||
+	    ftruncate(mapped_fd, slots * FS_BLOCK_SIZE) != 0) {
+		return BLOCKS_ERROR;
+	}
+	size_t offset = mapped_slots * FS_BLOCK_SIZE;
+	if (mmap(mapped_base + offset,
+	         slots * FS_BLOCK_SIZE - offset,
+	         PROT_READ | PROT_WRITE,
+	         MAP_SHARED | MAP_FIXED,
+	         mapped_fd,
+	         offset) == MAP_FAILED) {
+		return BLOCKS_ERROR;
+	}
+	mapped_slots = slots;
+	return 0;
+}
+
+// Get a block of memory for a new id, from the heap or the mapped file
+static char *
+new_block_data(block_id_t id)
+{
+	if (mapped_base == NULL) {
+		return calloc(1, FS_BLOCK_SIZE);
+	}
+	if (id >= mapped_slots && grow_mapping() != 0) {
+		return NULL;
+	}
+	char *data = mapped_base + (size_t) id * FS_BLOCK_SIZE;
+	memset(data, 0, FS_BLOCK_SIZE);
+	return data;
+}
+
+// Remember a written block of the mapped store, with blocks_lock held
+static void
+mark_dirty(block_id_t id)
+{
+	if (mapped_base != NULL && !dirty[id]) {
+		dirty[id] = 1;
+		dirty_ids[dirty_amount++] = id;
+	}
+}
+
+// Allocate a zero filled block, returns NO_BLOCK when out of memory
+block_id_t
+block_alloc()
+{
+	pthread_mutex_lock(&blocks_lock);
+	block_id_t id;
+	if (free_amount > 0) {
+		id = free_ids[free_amount - 1];
+	} else if (blocks_top < blocks_capacity || grow_table() == 0) {
+		id = blocks_top;
+	} else {
+		pthread_mutex_unlock(&blocks_lock);
+		return NO_BLOCK;
+	}
+	char *data = new_block_data(id);
+	if (data == NULL) {
+		pthread_mutex_unlock(&blocks_lock);
+		return NO_BLOCK;
+	}
+	if (free_amount > 0) {
+		free_amount--;
+	} else {
+		blocks_top++;
+	}
+	blocks[id] = data;
+	refs[id] = 1;
+	blocks_amount++;
+	mark_dirty(id);
+	pthread_mutex_unlock(&blocks_lock);
+	return id;
+}
+
+// Release a reference to a block, with blocks_lock held. The last one
+// frees it so its id can be reused.
+static void
+release(block_id_t id)
+{
+	if (refs[id] > 1) {
+		refs[id]--;
+		shared_amount--;
+		return;
+	}
+	unindex(id);
+	refs[id] = 0;
+	if (mapped_base == NULL) {
+		free(blocks[id]);
+	}
+	blocks[id] = NULL;
+	free_ids[free_amount++] = id;
+	blocks_amount--;
+}
+
+// Release a reference to a block, the last one frees it so its id can be
+// reused
+void
+block_free(block_id_t id)
+{
+	pthread_mutex_lock(&blocks_lock);
+	if (id != NO_BLOCK && id < blocks_top && blocks[id] != NULL) {
+		release(id);
+	}
+	pthread_mutex_unlock(&blocks_lock);
+}
+
+// References held to a block
+uint32_t
+block_refs(block_id_t id)
+{
+	pthread_mutex_lock(&blocks_lock);
+	uint32_t amount = refs[id];
+	pthread_mutex_unlock(&blocks_lock);
+	return amount;
+}
+
+// Get a block that the caller can write to in place of id: id itself,
+// taken out of the content index, if no one else references it, else a
+// copy that replaces the caller's reference. NO_BLOCK when out of memory,
+// keeping the reference to id.
+block_id_t
+block_own(block_id_t id)
+{
+	pthread_mutex_lock(&blocks_lock);
+	if (refs[id] == 1) {
+		unindex(id);
+		pthread_mutex_unlock(&blocks_lock);
+		return id;
+	}
+	pthread_mutex_unlock(&blocks_lock);
+	block_id_t copy = block_alloc();
+	if (copy == NO_BLOCK) {
+		return NO_BLOCK;
+	}
+	memcpy(block_data(copy), block_data(id), FS_BLOCK_SIZE);
+	block_free(id);
+	return copy;
+}
+
+// Share a block with one with the same contents, if any is indexed: the
+// reference to id is released and one to the other block is returned.
+// Otherwise id is indexed, so later blocks can share it, and returned. The
+// contents of id must not change while it is indexed.
+block_id_t
+block_dedup(block_id_t id)
+{
+	uint32_t hash = fnv1a_update(FNV_OFFSET_BASIS, block_data(id), FS_BLOCK_SIZE);
+	pthread_mutex_lock(&blocks_lock);
+	if (indexed[id]) {
+		pthread_mutex_unlock(&blocks_lock);
+		return id;
+	}
+	size_t bucket = bucket_of(hash, blocks_capacity);
+	for (block_id_t other = buckets[bucket]; other != NO_BLOCK;
+	     other = index_next[other]) {
+		if (hashes[other] == hash &&
+		    memcmp(blocks[other], blocks[id], FS_BLOCK_SIZE) == 0) {
+			refs[other]++;
+			shared_amount++;
+			release(id);
+			pthread_mutex_unlock(&blocks_lock);
+			return other;
+		}
+	}
+	hashes[id] = hash;
+	index_next[id] = buckets[bucket];
+	buckets[bucket] = id;
+	indexed[id] = 1;
+	pthread_mutex_unlock(&blocks_lock);
+	return id;
+}
+
+// References saved by sharing blocks: blocks that would be allocated if
+// every reference had its own
+size_t
+blocks_shared()
+{
+	return shared_amount;
+}
+
+// Get the contents of a block. Only the owner of the block may call it,
+// so the entry can't change under it even if another id is allocated.
+char *
+block_data(block_id_t id)
+{
+	char **table = __atomic_load_n(&blocks, __ATOMIC_ACQUIRE);
+	return table[id];
+}
+
+// Note that the contents of a block changed, so the next sync writes it
+void
+block_dirty(block_id_t id)
+{
+	if (mapped_base == NULL) {
+		return;
+	}
+	pthread_mutex_lock(&blocks_lock);
+	mark_dirty(id);
+	pthread_mutex_unlock(&blocks_lock);
+}
+
+// Release every block of the store, unmapping the mapped file if any
+void
+blocks_reset()
+{
+	if (mapped_base != NULL) {
+		munmap(mapped_base, BLOCKS_MAP_RESERVE);
+		close(mapped_fd);
+	} else {
+		for (size_t i = FIRST_BLOCK; i < blocks_top; i++) {
+			free(blocks[i]);
+		}
+	}
+	free(blocks);
+	for (size_t i = 0; i < old_tables_amount; i++) {
+		free(old_tables[i]);
+	}
+	old_tables_amount = 0;
+	free(free_ids);
+	free(dirty_ids);
+	free(dirty);
+	free(refs);
+	free(hashes);
+	free(index_next);
+	free(indexed);
+	free(buckets);
+	blocks = NULL;
+	free_ids = NULL;
+	dirty_ids = NULL;
+	dirty = NULL;
+	refs = NULL;
+	hashes = NULL;
+	index_next = NULL;
+	indexed = NULL;
+	buckets = NULL;
+	shared_amount = 0;
+	mapped_base = NULL;
+	mapped_fd = -1;
+	mapped_slots = 0;
+	blocks_capacity = 0;
+	blocks_top = FIRST_BLOCK;
+	blocks_amount = 0;
+	free_amount = 0;
+	dirty_amount = 0;
+}
+
+// Amount of blocks currently allocated
+size_t
+blocks_used()
+{
+	return blocks_amount;
+}
+
+// Keep every other thread out of the store until blocks_thaw, so a fork
+// in between gets it consistent and unlocked
+void
+blocks_freeze()
+{
+	pthread_mutex_lock(&blocks_lock);
+}
+
+void
+blocks_thaw()
+{
+	pthread_mutex_unlock(&blocks_lock);
+}
+
+// Blocks that can still be allocated: what is left of the address range
+// of the mapped file, or else as many as fit in the free memory
+size_t
+blocks_available()
+{
+	pthread_mutex_lock(&blocks_lock);
+	size_t ids = UINT32_MAX - FIRST_BLOCK - blocks_amount;
+	size_t available;
+	if (mapped_base != NULL) {
+		available = BLOCKS_MAP_RESERVE / FS_BLOCK_SIZE - FIRST_BLOCK - blocks_amount;
+	} else {
+		available = (size_t) sysconf(_SC_AVPHYS_PAGES) *
+		            sysconf(_SC_PAGESIZE) / FS_BLOCK_SIZE;
+	}
+	pthread_mutex_unlock(&blocks_lock);
+	return available < ids ? available : ids;
+}
+
+// Use the file at path as the block store. Every block starts unused
+// until claimed with block_claim, then blocks_map_ready frees the rest.
+int
+blocks_map_open(const char *path)
+{
+	blocks_reset();
+	int fd = open(path, O_RDWR | O_CREAT, BLOCKS_FILE_MODE);
+	struct stat st;
+	if (fd < 0 || fstat(fd, &st) != 0) {
+		if (fd >= 0) {
+			close(fd);
+		}
+		return BLOCKS_ERROR;
+	}
+	size_t slots = st.st_size / FS_BLOCK_SIZE;
+	if (slots < FIRST_BLOCK) {
+		slots = FIRST_BLOCK;
+	}
+	char *base = mmap(NULL,
+	                  BLOCKS_MAP_RESERVE,
+	                  PROT_NONE,
+	                  MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE,
+	                  -1,
+	                  0);
+	if (base == MAP_FAILED || slots * FS_BLOCK_SIZE > BLOCKS_MAP_RESERVE ||
+	    ftruncate(fd, slots * FS_BLOCK_SIZE) != 0 ||
+	    mmap(base,
+	         slots * FS_BLOCK_SIZE,
+	         PROT_READ | PROT_WRITE,
+	         MAP_SHARED | MAP_FIXED,
+	         fd,
+	         0) == MAP_FAILED) {
+		if (base != MAP_FAILED) {
+			munmap(base, BLOCKS_MAP_RESERVE);
+		}
+		close(fd);
+		return BLOCKS_ERROR;
+	}
+	mapped_fd = fd;
+	mapped_base = base;
+	mapped_slots = slots;
+	while (blocks_capacity < slots) {
+		if (grow_table() != 0) {
+			blocks_reset();
+			return BLOCKS_ERROR;
+		}
+	}
+	blocks_top = slots;
+	return 0;
+}
+
+// Mark a block of the mapped file as in use while loading
+int
+block_claim(block_id_t id)
+{
+	if (mapped_base == NULL || id == NO_BLOCK || id >= blocks_top) {
+		return BLOCKS_ERROR;
+	}
+	if (blocks[id] == NULL) {
+		blocks[id] = mapped_base + (size_t) id * FS_BLOCK_SIZE;
+		refs[id] = 1;
+		blocks_amount++;
+	}
+	return 0;
+}
+
+// Finish loading the mapped file: every unclaimed block becomes free
+void
+blocks_map_ready()
+{
+	free_amount = 0;
+	for (size_t id = blocks_top - 1; id >= FIRST_BLOCK; id--) {
+		if (blocks[id] == NULL) {
+			free_ids[free_amount++] = id;
+		}
+	}
+}
+
+// Whether the block store lives in a mapped file
+bool
+blocks_mapped()
+{
+	return mapped_base != NULL;
+}
+
+// Compare block ids, for sorting
+static int
+compare_ids(const void *a, const void *b)
+{
+	block_id_t x = *(const block_id_t *) a;
+	block_id_t y = *(const block_id_t *) b;
+	return (x > y) - (x < y);
+}
+
+// Write the dirty blocks of the mapped file back to disk, one msync per
+// run of consecutive blocks
+int
+blocks_sync()
+{
+	pthread_mutex_lock(&blocks_lock);
+	if (mapped_base == NULL || dirty_amount == 0) {
+		pthread_mutex_unlock(&blocks_lock);
+		return 0;
+	}
+	qsort(dirty_ids, dirty_amount, sizeof(block_id_t), compare_ids);
+	size_t page = sysconf(_SC_PAGESIZE);
+	int res = 0;
+	for (size_t i = 0; i < dirty_amount;) {
+		size_t j = i + 1;
+		while (j < dirty_amount && dirty_ids[j] == dirty_ids[j - 1] + 1) {
+			j++;
+		}
+		size_t start = (size_t) dirty_ids[i] * FS_BLOCK_SIZE;
+		size_t end = ((size_t) dirty_ids[j - 1] + 1) * FS_BLOCK_SIZE;
+		start -= start % page;
+		if (msync(mapped_base + start, end - start, MS_SYNC) != 0) {
+			res = BLOCKS_ERROR;
+		}
+		for (size_t k = i; k < j; k++) {
+			dirty[dirty_ids[k]] = 0;
+		}
+		i = j;
+	}
+	dirty_amount = 0;
+	pthread_mutex_unlock(&blocks_lock);
+	return res;
+}
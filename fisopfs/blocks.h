@@ -0,0 +1,44 @@
+#ifndef BLOCKS_H_
+#define BLOCKS_H_
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+#define FS_BLOCK_SIZE 4096 // Size of a file data block
+#define NO_BLOCK 0 // Block id that never refers to a block
+#define FIRST_BLOCK 1 // First valid block id
+#define BLOCKS_INITIAL_CAPACITY 64 // Initial size of the block table
+#define BLOCKS_MAP_RESERVE ((size_t) 1 << 36) // Address space kept for the mapped file
+#define BLOCKS_MAP_GROW 256 // Blocks added each time the mapped file grows
+#define BLOCKS_FILE_MODE 0644 // Permissions of a new mapped file
+#define BLOCKS_MAX_TABLES 32 // Outgrown block tables kept until the store is reset
+#define BLOCKS_ERROR -1
+
+typedef uint32_t block_id_t;
+
+// Block store functions
+block_id_t block_alloc();
+void block_free(block_id_t id);
+char *block_data(block_id_t id);
+void block_dirty(block_id_t id);
+void blocks_reset();
+size_t blocks_used();
+size_t blocks_available();
+void blocks_freeze();
+void blocks_thaw();
+
+// Shared blocks: a block can be referenced by several files, each
+// block_free releases one reference
+uint32_t block_refs(block_id_t id);
+block_id_t block_own(block_id_t id);
+block_id_t block_dedup(block_id_t id);
+size_t blocks_shared();
+
+// Mapped block store functions
+int blocks_map_open(const char *path);
+int block_claim(block_id_t id);
+void blocks_map_ready();
+bool blocks_mapped();
+int blocks_sync();
+
+#endif  // BLOCKS_H_
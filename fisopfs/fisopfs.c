@@ -1,20 +1,25 @@
 #define FUSE_USE_VERSION 30
+#define _GNU_SOURCE
 #include "fs.h"
 
 char *filedisk = DEFAULT_FILE_DISK;
 
+// Whether path is STATS_FILE, at the root
+static bool
+is_stats(const char *path)
+{
+	return path[0] == SLASH && strcmp(path + 1, STATS_FILE) == 0;
+}
+
 static void *
 fisopfs_init(struct fuse_conn_info *conn)
 {
-	printf(LOG_INIT_START);
-	if (fs_deserialize(filedisk) != 0) {
-		printf(LOG_NO_PERSIST);
-		fs_initialize();
-		if (fs_serialize(filedisk) != 0) {
-			fprintf(stderr, ERR_SERIALIZE);
-		}
-	} else {
-		printf(LOG_FS_LOADED);
+	log_info(LOG_INIT_START);
+	fs_lock_tree(WRITE_LOCK);
+	fs_mount(filedisk);
+	fs_unlock_tree();
+	if (fs_writeback_start(filedisk) != EXIT_SUCCESS) {
+		log_error(ERR_WRITEBACK_START);
 	}
 	return NULL;
 }
@@ -22,46 +27,157 @@ fisopfs_init(struct fuse_conn_info *conn)
 static void
 fisopfs_destroy(void *data)
 {
-	printf(LOG_DESTROY);
-	if (fs_serialize(filedisk) != 0) {
-		fprintf(stderr, ERR_SERIALIZE);
+	log_info(LOG_DESTROY);
+	fs_writeback_stop();
+	fs_lock_tree(WRITE_LOCK);
+	if (fs_checkpoint(filedisk) != 0) {
+		log_error(ERR_SERIALIZE);
 	}
+	fs_unlock_tree();
 }
 
 static int
 fisopfs_flush(const char *path, struct fuse_file_info *fi)
 {
-	printf(LOG_FLUSH, path);
-	if (fs_serialize(filedisk) != 0) {
-		fprintf(stderr, ERR_FLUSH);
-		return -EIO;
+	log_debug(LOG_FLUSH, path);
+	uint64_t start = stats_start();
+	if (fs_writeback_enabled()) {
+		// Left to the flusher thread, fsync is the way to wait for it
+		return stats_done(STAT_FLUSH, start, EXIT_SUCCESS);
+	}
+	fs_lock_tree(WRITE_LOCK);
+	int res = fs_flush(filedisk);
+	fs_unlock_tree();
+	if (res != 0) {
+		log_error(ERR_FLUSH);
+		return stats_done(STAT_FLUSH, start, -EIO);
+	}
+	return stats_done(STAT_FLUSH, start, EXIT_SUCCESS);
+}
+
+// Every change so far is made durable, not only those of the file: the
+// journal is shared by the whole filesystem
+static int
+fisopfs_fsync(const char *path, int datasync, struct fuse_file_info *fi)
+{
+	log_debug(LOG_FSYNC, path);
+	uint64_t start = stats_start();
+	fs_lock_tree(WRITE_LOCK);
+	int res = fs_sync(filedisk);
+	fs_unlock_tree();
+	if (res != 0) {
+		log_error(ERR_FSYNC);
+		return stats_done(STAT_FSYNC, start, -EIO);
+	}
+	return stats_done(STAT_FSYNC, start, EXIT_SUCCESS);
+}
+
+// Lock the inode of the file opened as fi, looking up path only when it
+// wasn't opened by fisopfs_open or fisopfs_create
+static int
+open_file_lock(const char *path, struct fuse_file_info *fi, bool write)
+{
+	if (fi == NULL || fi->fh == NO_HANDLE) {
+		return fs_lookup_lock(path, write);
+	}
+	return fs_handle_lock(fi->fh, write);
+}
+
+// Open STATS_FILE, only for reading. Each read formats the statistics
+// anew, so the kernel must not cache them nor stop at the size it got.
+static int
+open_stats(struct fuse_file_info *fi)
+{
+	if ((fi->flags & O_ACCMODE) != O_RDONLY) {
+		return -EACCES;
 	}
+	fi->direct_io = 1;
+	fi->fh = NO_HANDLE;
 	return EXIT_SUCCESS;
 }
 
+static int
+fisopfs_open(const char *path, struct fuse_file_info *fi)
+{
+	log_debug(LOG_OPEN, path);
+	uint64_t start = stats_start();
+	if (is_stats(path)) {
+		return stats_done(STAT_OPEN, start, open_stats(fi));
+	}
+	int index = fs_lookup_lock(path, READ_LOCK);
+	if (index == BAD_INDEX) {
+		return stats_done(STAT_OPEN, start, -ENOENT);
+	}
+	int res = -EISDIR;
+	if (fs_inode(index)->type == FILE_TYPE) {
+		fi->fh = fs_handle(index);
+		res = EXIT_SUCCESS;
+	}
+	fs_unlock(index);
+	return stats_done(STAT_OPEN, start, res);
+}
 
 static int
 fisopfs_getattr(const char *path, struct stat *st)
 {
-	printf(LOG_GETATTR, path);
+	log_debug(LOG_GETATTR, path);
+	uint64_t start = stats_start();
+	if (is_stats(path)) {
+		stats_stat(st);
+		st->st_ino = STATS_INO;
+		return stats_done(STAT_GETATTR, start, EXIT_SUCCESS);
+	}
 	memset(st, 0, sizeof(struct stat));
-	int index = fs_lookup(path);
+	int index = fs_lookup_lock(path, READ_LOCK);
 	if (index == BAD_INDEX) {
-		printf(LOG_GETATTR_NOT_FOUND, path);
-		return -ENOENT;
+		log_debug(LOG_GETATTR_NOT_FOUND, path);
+		return stats_done(STAT_GETATTR, start, -ENOENT);
 	}
-	inode_t *inode = &fs.inodes[index];
-	st->st_dev = 0;
-	st->st_ino = index;
-	st->st_uid = inode->uid;
-	st->st_gid = inode->gid;
-	st->st_mode = inode->mode;
-	st->st_nlink = inode->nlink;
-	st->st_size = inode->size;
-	st->st_atime = inode->access_time;
-	st->st_mtime = inode->modification_time;
-	st->st_ctime = inode->creation_time;
-	return EXIT_SUCCESS;
+	fs_stat(index, st);
+	fs_unlock(index);
+	return stats_done(STAT_GETATTR, start, EXIT_SUCCESS);
+}
+
+static int
+fisopfs_fgetattr(const char *path, struct stat *st, struct fuse_file_info *fi)
+{
+	log_debug(LOG_GETATTR, path);
+	uint64_t start = stats_start();
+	if (is_stats(path)) {
+		stats_stat(st);
+		st->st_ino = STATS_INO;
+		return stats_done(STAT_GETATTR, start, EXIT_SUCCESS);
+	}
+	memset(st, 0, sizeof(struct stat));
+	int index = open_file_lock(path, fi, READ_LOCK);
+	if (index == BAD_INDEX) {
+		log_debug(LOG_GETATTR_NOT_FOUND, path);
+		return stats_done(STAT_GETATTR, start, -ENOENT);
+	}
+	fs_stat(index, st);
+	fs_unlock(index);
+	return stats_done(STAT_GETATTR, start, EXIT_SUCCESS);
+}
+
+// Buffer of fisopfs_readdir being filled
+typedef struct dir_fill {
+	void *buffer;
+	fuse_fill_dir_t filler;
+} dir_fill_t;
+
+// Add an entry to the buffer of fisopfs_readdir along with its attributes,
+// so listing with them doesn't need a getattr per entry
+static int
+fill_entry(void *ctx, const char *name, int index, off_t next)
+{
+	dir_fill_t *fill = ctx;
+	struct stat st;
+	memset(&st, 0, sizeof(struct stat));
+	fs_lock_inode(index, READ_LOCK);
+	fs_stat(index, &st);
+	fs_unlock_inode(index);
+	log_debug(LOG_READDIR_FOUND, name);
+	return fill->filler(fill->buffer, name, &st, next);
 }
 
 static int
@@ -71,26 +187,23 @@ fisopfs_readdir(const char *path,
                 off_t offset,
                 struct fuse_file_info *fi)
 {
-	printf(LOG_READDIR, path);
-	filler(buffer, ".", NULL, 0);
-	filler(buffer, "..", NULL, 0);
+	log_debug(LOG_READDIR, path);
+	uint64_t start = stats_start();
+	// Only the tree is locked, each entry is locked while it is read
+	fs_lock_tree(READ_LOCK);
 	int index = fs_lookup(path);
+	int res = EXIT_SUCCESS;
 	if (index == BAD_INDEX) {
-		return -ENOENT;
-	}
-	inode_t *inode = &fs.inodes[index];
-	if (inode->type != DIR_TYPE) {
-		fprintf(stderr, ERR_NOT_DIR_RMDIR);
-		return -ENOTDIR;
-	}
-	for (int i = 0; i < MAX_INODES; i++) {
-		if (fs.inodes_bitmap[i] == USED_INODE &&
-		    strcmp(fs.inodes[i].prev_path, inode->path) == 0) {
-			printf(LOG_READDIR, fs.inodes[i].name);
-			filler(buffer, fs.inodes[i].name, NULL, 0);
-		}
+		res = -ENOENT;
+	} else if (fs_inode(index)->type != DIR_TYPE) {
+		log_error(ERR_NOT_DIR);
+		res = -ENOTDIR;
+	} else {
+		dir_fill_t fill = { .buffer = buffer, .filler = filler };
+		fs_list_dir(index, offset, fill_entry, &fill);
 	}
-	return EXIT_SUCCESS;
+	fs_unlock_tree();
+	return stats_done(STAT_READDIR, start, res);
 }
 
 static int
@@ -100,26 +213,24 @@ fisopfs_read(const char *path,
              off_t offset,
              struct fuse_file_info *fi)
 {
-	printf(LOG_READ, path, offset, size);
-	int index = fs_lookup(path);
-	if (index == BAD_INDEX) {
-		printf(ERR_READ_NOT_FOUND, path);
-		return -ENOENT;
+	log_debug(LOG_READ, path, offset, size);
+	uint64_t start = stats_start();
+	if (is_stats(path)) {
+		return stats_done(STAT_READ, start, stats_read(buffer, size, offset));
 	}
-	inode_t *inode = &fs.inodes[index];
-	if (inode->type != FILE_TYPE) {
-		return -EISDIR;
-	}
-	if (offset >= inode->size) {
-		return NO_DATA_READ;
+	int index = open_file_lock(path, fi, READ_LOCK);
+	if (index == BAD_INDEX) {
+		log_debug(ERR_READ_NOT_FOUND, path);
+		return stats_done(STAT_READ, start, -ENOENT);
 	}
-	size_t len = inode->size - offset;
-	if (len > size) {
-		len = size;
+	inode_t *inode = fs_inode(index);
+	ssize_t len = -EISDIR;
+	if (inode->type == FILE_TYPE) {
+		len = fs_read_data(index, buffer, size, offset);
+		fs_mark_read(index);
 	}
-	memcpy(buffer, inode->data + offset, len);
-	inode->access_time = time(NULL);
-	return len;
+	fs_unlock(index);
+	return stats_done(STAT_READ, start, len);
 }
 
 // Check the depth of the path to ensure it does not exceed MAX_DEPTH
@@ -146,159 +257,304 @@ path_depth(const char *path)
 static int
 fisopfs_mkdir(const char *path, mode_t mode)
 {
-	printf(LOG_MKDIR, path, mode);
+	log_debug(LOG_MKDIR, path, mode);
+	uint64_t start = stats_start();
 	if (path_depth(path) > MAX_DEPTH) {
-		fprintf(stderr, ERR_DEPTH);
-		return -ENAMETOOLONG;
+		log_error(ERR_DEPTH);
+		return stats_done(STAT_MKDIR, start, -ENAMETOOLONG);
 	}
-	if (fs_lookup(path) >= 0) {
-		return -EEXIST;
+	fs_lock_tree(WRITE_LOCK);
+	int res = -EEXIST;
+	if (!is_stats(path) && fs_lookup(path) == BAD_INDEX) {
+		res = fs_create_entry(path, mode, DIR_TYPE);
 	}
-	return fs_create_entry(path, mode, DIR_TYPE);
+	fs_unlock_tree();
+	return stats_done(STAT_MKDIR, start, res < 0 ? res : EXIT_SUCCESS);
 }
 
 static int
 fisopfs_create(const char *path, mode_t mode, struct fuse_file_info *fi)
 {
-	printf(LOG_CREATE, path, mode);
-	if (fs_lookup(path) >= 0)
-		return -EEXIST;
-	return fs_create_entry(path, mode, FILE_TYPE);
+	log_debug(LOG_CREATE, path, mode);
+	uint64_t start = stats_start();
+	fs_lock_tree(WRITE_LOCK);
+	int res = -EEXIST;
+	if (!is_stats(path) && fs_lookup(path) == BAD_INDEX) {
+		res = fs_create_entry(path, mode, FILE_TYPE);
+	}
+	if (res >= 0) {
+		fi->fh = fs_handle(res);
+		res = EXIT_SUCCESS;
+	}
+	fs_unlock_tree();
+	return stats_done(STAT_CREATE, start, res);
 }
 
+// Remove the directory at path, with the tree locked for writing
 static int
-fisopfs_rmdir(const char *path)
+remove_dir(const char *path)
 {
-	printf(LOG_RMDIR, path);
 	int index = fs_lookup(path);
 	if (index == BAD_INDEX) {
-		printf(ERR_RM_NOT_FOUND, path);
+		log_debug(ERR_RM_NOT_FOUND, path);
 		return -ENOENT;
 	}
-	inode_t *inode = &fs.inodes[index];
+	inode_t *inode = fs_inode(index);
 	if (inode->type != DIR_TYPE) {
-		fprintf(stderr, ERR_NOT_DIR_RMDIR);
+		log_error(ERR_NOT_DIR_RMDIR);
 		return -ENOTDIR;
 	}
-	if (inode->nlink > MIN_DIR_NLINKS) {
-		fprintf(stderr, ERR_NOT_EMPTY);
+	if (inode->first_child != BAD_INDEX) {
+		log_error(ERR_NOT_EMPTY);
 		return -ENOTEMPTY;
 	}
-	if (strcmp(inode->path, SLASH_STR) == 0) {
-		fprintf(stderr, ERR_RM_ROOT);
+	if (index == ROOT_INDEX) {
+		log_error(ERR_RM_ROOT);
 		return -EPERM;
 	}
-	fs.inodes_bitmap[index] = NOT_USED_INODE;
-	modify_nlink_path(inode->prev_path, false);
-	memset(inode, 0, sizeof(inode_t));
+	fs_remove_entry(index);
 	return EXIT_SUCCESS;
 }
 
 static int
-fisopfs_write(const char *path,
-              const char *buffer,
-              size_t size,
-              off_t offset,
-              struct fuse_file_info *fi)
+fisopfs_rmdir(const char *path)
 {
-	printf(LOG_WRITE, path, buffer, size, offset);
-	int index = fs_lookup(path);
-	if (index == BAD_INDEX) {
-		printf(ERR_WRITE_NOT_FOUND, path);
-		return -ENOENT;
-	}
-	inode_t *inode = &fs.inodes[index];
+	log_debug(LOG_RMDIR, path);
+	uint64_t start = stats_start();
+	fs_lock_tree(WRITE_LOCK);
+	int res = is_stats(path) ? -ENOTDIR : remove_dir(path);
+	fs_unlock_tree();
+	return stats_done(STAT_RMDIR, start, res);
+}
+
+// Write to the file at index, locked for writing
+static int
+write_file(int index, struct fuse_bufvec *buffer, size_t size, off_t offset)
+{
+	inode_t *inode = fs_inode(index);
 	if (inode->type != FILE_TYPE) {
-		fprintf(stderr, ERR_WRITE_TYPE);
+		log_error(ERR_WRITE_TYPE);
 		return -EISDIR;
 	}
-	if (inode->size < offset) {
-		memset(inode->data + inode->size, 0, offset - inode->size);
-	}
-	if (offset + size > MAX_DATA) {
-		fprintf(stderr, ERR_WRITE_SPACE);
-		return -ENOSPC;
+	if (offset + size > MAX_FILE_SIZE) {
+		log_error(ERR_WRITE_SIZE);
+		return -EFBIG;
 	}
 	struct fuse_context *context = fuse_get_context();
 	if (inode->uid != context->uid) {
-		fprintf(stderr, ERR_WRITE_PERM);
+		log_error(ERR_WRITE_PERM);
 		return -EACCES;
 	}
-	memcpy(inode->data + offset, buffer, size);
+	ssize_t written = fs_write_bufvec(index, buffer, size, offset);
+	if (written < 0) {
+		log_error(ERR_WRITE_SPACE);
+		return written;
+	}
 	inode->access_time = time(NULL);
 	inode->modification_time = time(NULL);
-	if (inode->size < offset + size) {
-		inode->size = offset + size;
+	return (int) written;
+}
+
+// fuse copies the bytes written straight into the blocks of the file
+static int
+fisopfs_write_buf(const char *path,
+                  struct fuse_bufvec *buffer,
+                  off_t offset,
+                  struct fuse_file_info *fi)
+{
+	size_t size = fuse_buf_size(buffer);
+	log_debug(LOG_WRITE, path, size, offset);
+	uint64_t start = stats_start();
+	int index = open_file_lock(path, fi, WRITE_LOCK);
+	if (index == BAD_INDEX) {
+		log_debug(ERR_WRITE_NOT_FOUND, path);
+		return stats_done(STAT_WRITE, start, -ENOENT);
 	}
-	return (int) size;
+	int res = write_file(index, buffer, size, offset);
+	fs_unlock(index);
+	return stats_done(STAT_WRITE, start, res);
+}
+
+// Change the size of the file at index, locked for writing
+static int
+truncate_file(int index, off_t size)
+{
+	inode_t *inode = fs_inode(index);
+	if (inode->type != FILE_TYPE) {
+		log_error(ERR_TRUNC_TYPE);
+		return -EISDIR;
+	}
+	struct fuse_context *context = fuse_get_context();
+	if (inode->uid != context->uid) {
+		log_error(ERR_TRUNC_PERM);
+		return -EACCES;
+	}
+	int res = fs_truncate_data(index, size);
+	if (res != EXIT_SUCCESS) {
+		log_error(ERR_TRUNC_SPACE);
+		return res;
+	}
+	inode->modification_time = time(NULL);
+	return EXIT_SUCCESS;
 }
 
 static int
 fisopfs_truncate(const char *path, off_t size)
 {
-	printf(LOG_TRUNCATE, path, size);
-	if (size > MAX_DATA) {
-		fprintf(stderr, ERR_TRUNC_SIZE);
-		return -EINVAL;
+	log_debug(LOG_TRUNCATE, path, size);
+	uint64_t start = stats_start();
+	if (is_stats(path)) {
+		return stats_done(STAT_SETATTR, start, -EACCES);
+	}
+	if (size > MAX_FILE_SIZE) {
+		log_error(ERR_TRUNC_SIZE);
+		return stats_done(STAT_SETATTR, start, -EFBIG);
 	}
 
-	int index = fs_lookup(path);
+	int index = fs_lookup_lock(path, WRITE_LOCK);
 	if (index == BAD_INDEX) {
-		fprintf(stderr, ERR_TRUNC_NOT_FOUND, path);
-		return -ENOENT;
+		log_error(ERR_TRUNC_NOT_FOUND, path);
+		return stats_done(STAT_SETATTR, start, -ENOENT);
 	}
-	inode_t *inode = &fs.inodes[index];
+	int res = truncate_file(index, size);
+	fs_unlock(index);
+	return stats_done(STAT_SETATTR, start, res);
+}
+
+static int
+fisopfs_ftruncate(const char *path, off_t size, struct fuse_file_info *fi)
+{
+	log_debug(LOG_FTRUNCATE, path, size);
+	uint64_t start = stats_start();
+	if (size > MAX_FILE_SIZE) {
+		log_error(ERR_TRUNC_SIZE);
+		return stats_done(STAT_SETATTR, start, -EFBIG);
+	}
+	int index = open_file_lock(path, fi, WRITE_LOCK);
+	if (index == BAD_INDEX) {
+		log_error(ERR_TRUNC_NOT_FOUND, path);
+		return stats_done(STAT_SETATTR, start, -ENOENT);
+	}
+	int res = truncate_file(index, size);
+	fs_unlock(index);
+	return stats_done(STAT_SETATTR, start, res);
+}
+
+// Allocate or punch a range of the file at index, locked for writing
+static int
+allocate_file(int index, int mode, off_t offset, off_t len)
+{
+	inode_t *inode = fs_inode(index);
 	if (inode->type != FILE_TYPE) {
-		fprintf(stderr, ERR_TRUNC_TYPE);
+		log_error(ERR_TRUNC_TYPE);
 		return -EISDIR;
 	}
 	struct fuse_context *context = fuse_get_context();
 	if (inode->uid != context->uid) {
-		fprintf(stderr, ERR_TRUNC_PERM);
+		log_error(ERR_TRUNC_PERM);
 		return -EACCES;
 	}
-	inode->modification_time = time(NULL);
-	if (size < inode->size) {
-		memset(inode->data + size,
-		       0,
-		       inode->size - size);  // Clear the data beyond the new size
+	int res = fs_fallocate_data(index, mode, offset, len);
+	if (res != EXIT_SUCCESS) {
+		return res;
 	}
-	inode->size = size;
+	inode->modification_time = time(NULL);
 	return EXIT_SUCCESS;
 }
 
 static int
-fisopfs_unlink(const char *path)
+fisopfs_fallocate(const char *path,
+                  int mode,
+                  off_t offset,
+                  off_t len,
+                  struct fuse_file_info *fi)
+{
+	log_debug(LOG_FALLOCATE, path, mode, offset, len);
+	uint64_t start = stats_start();
+	if (is_stats(path)) {
+		return stats_done(STAT_FALLOCATE, start, -EACCES);
+	}
+	int index = open_file_lock(path, fi, WRITE_LOCK);
+	if (index == BAD_INDEX) {
+		return stats_done(STAT_FALLOCATE, start, -ENOENT);
+	}
+	int res = allocate_file(index, mode, offset, len);
+	fs_unlock(index);
+	return stats_done(STAT_FALLOCATE, start, res);
+}
+
+// Remove the file at path, with the tree locked for writing
+static int
+remove_file(const char *path)
 {
-	printf(LOG_UNLINK, path);
 	int index = fs_lookup(path);
 	if (index == BAD_INDEX) {
 		return -ENOENT;
 	}
-	inode_t *inode = &fs.inodes[index];
+	inode_t *inode = fs_inode(index);
 	if (inode->type != FILE_TYPE) {
-		fprintf(stderr, ERR_UNLINK_TYPE);
+		log_error(ERR_UNLINK_TYPE);
 		return -EISDIR;
 	}
 	struct fuse_context *context = fuse_get_context();
 	if (context->uid != 0 && inode->uid != context->uid) {
-		fprintf(stderr, ERR_UNLINK_PERM);
+		log_error(ERR_UNLINK_PERM);
 		return -EACCES;
 	}
-	fs.inodes_bitmap[index] = NOT_USED_INODE;
-	memset(inode, 0, sizeof(inode_t));
+	fs_remove_entry(index);
 	return EXIT_SUCCESS;
 }
 
+static int
+fisopfs_unlink(const char *path)
+{
+	log_debug(LOG_UNLINK, path);
+	uint64_t start = stats_start();
+	fs_lock_tree(WRITE_LOCK);
+	int res = is_stats(path) ? -EACCES : remove_file(path);
+	fs_unlock_tree();
+	return stats_done(STAT_UNLINK, start, res);
+}
+
+// Move the entry at from to to, with the tree locked for writing
+static int
+rename_entry(const char *from, const char *to)
+{
+	const char *name;
+	int index = fs_lookup(from);
+	if (index == BAD_INDEX) {
+		return -ENOENT;
+	}
+	int parent = fs_lookup_parent(to, &name);
+	if (parent == BAD_INDEX) {
+		return -ENOENT;
+	}
+	return fs_rename(index, parent, name, 0);
+}
+
+static int
+fisopfs_rename(const char *from, const char *to)
+{
+	log_debug(LOG_RENAME, from, to);
+	uint64_t start = stats_start();
+	fs_lock_tree(WRITE_LOCK);
+	int res = is_stats(from) || is_stats(to) ? -EACCES : rename_entry(from, to);
+	fs_unlock_tree();
+	return stats_done(STAT_RENAME, start, res);
+}
+
 static int
 fisopfs_utimens(const char *path, const struct timespec tv[2])
 {
-	printf(LOG_UTIMENS, path);
-	int index = fs_lookup(path);
+	log_debug(LOG_UTIMENS, path);
+	if (is_stats(path)) {
+		return -EACCES;
+	}
+	int index = fs_lookup_lock(path, WRITE_LOCK);
 	if (index == BAD_INDEX) {
 		return -ENOENT;
 	}
-	inode_t *inode = &fs.inodes[index];
+	inode_t *inode = fs_inode(index);
 	if (tv == NULL) {  // By FUSE documentation, tv can be NULL
 		time_t now = time(NULL);
 		inode->access_time = now;
@@ -307,6 +563,8 @@ fisopfs_utimens(const char *path, const struct timespec tv[2])
 		inode->access_time = tv[0].tv_sec;
 		inode->modification_time = tv[1].tv_sec;
 	}
+	fs_mark_dirty(index, DIRTY_META);
+	fs_unlock(index);
 	return EXIT_SUCCESS;
 }
 
@@ -326,15 +584,11 @@ has_read_permission(const inode_t *inode, uid_t uid, gid_t gid)
 	return (inode->mode & S_IROTH);
 }
 
+// Change the owner of the inode at index, locked for writing
 static int
-fisopfs_chown(const char *path, uid_t uid, gid_t gid)
+change_owner(int index, uid_t uid, gid_t gid)
 {
-	printf(LOG_CHOWN, path, uid, gid);
-	int index = fs_lookup(path);
-	if (index == BAD_INDEX) {
-		return -ENOENT;
-	}
-	inode_t *inode = &fs.inodes[index];
+	inode_t *inode = fs_inode(index);
 	struct fuse_context *context = fuse_get_context();
 	if (context->uid != 0) {
 		return -EPERM;
@@ -346,61 +600,98 @@ fisopfs_chown(const char *path, uid_t uid, gid_t gid)
 		inode->gid = gid;
 	}
 	inode->modification_time = time(NULL);
+	fs_mark_dirty(index, DIRTY_META);
 	return EXIT_SUCCESS;
 }
 
 static int
-fisopfs_chmod(const char *path, mode_t mode)
+fisopfs_chown(const char *path, uid_t uid, gid_t gid)
 {
-	printf(LOG_CHMOD, path, mode);
-	int index = fs_lookup(path);
+	log_debug(LOG_CHOWN, path, uid, gid);
+	if (is_stats(path)) {
+		return -EACCES;
+	}
+	int index = fs_lookup_lock(path, WRITE_LOCK);
 	if (index == BAD_INDEX) {
 		return -ENOENT;
 	}
-	inode_t *inode = &fs.inodes[index];
+	int res = change_owner(index, uid, gid);
+	fs_unlock(index);
+	return res;
+}
+
+// Change the permissions of the inode at index, locked for writing
+static int
+change_mode(int index, mode_t mode)
+{
+	inode_t *inode = fs_inode(index);
 	struct fuse_context *context = fuse_get_context();
 	if (context->uid != 0 && context->uid != inode->uid) {
 		return -EPERM;
 	}
 	inode->mode = (inode->mode & ~07777) | (mode & 07777);
 	inode->modification_time = time(NULL);
+	fs_mark_dirty(index, DIRTY_META);
 	return EXIT_SUCCESS;
 }
 
+static int
+fisopfs_chmod(const char *path, mode_t mode)
+{
+	log_debug(LOG_CHMOD, path, mode);
+	if (is_stats(path)) {
+		return -EACCES;
+	}
+	int index = fs_lookup_lock(path, WRITE_LOCK);
+	if (index == BAD_INDEX) {
+		return -ENOENT;
+	}
+	int res = change_mode(index, mode);
+	fs_unlock(index);
+	return res;
+}
+
+static int
+fisopfs_statfs(const char *path, struct statvfs *st)
+{
+	log_debug(LOG_STATFS, path);
+	fs_lock_tree(READ_LOCK);
+	fs_statfs(st);
+	fs_unlock_tree();
+	return EXIT_SUCCESS;
+}
 
 static struct fuse_operations operations = {
 	.getattr = fisopfs_getattr,
+	.fgetattr = fisopfs_fgetattr,
+	.open = fisopfs_open,
 	.readdir = fisopfs_readdir,
 	.read = fisopfs_read,
-	.write = fisopfs_write,
+	.write_buf = fisopfs_write_buf,
 	.mkdir = fisopfs_mkdir,
 	.init = fisopfs_init,
 	.unlink = fisopfs_unlink,
 	.create = fisopfs_create,
 	.rmdir = fisopfs_rmdir,
+	.rename = fisopfs_rename,
 	.truncate = fisopfs_truncate,
+	.ftruncate = fisopfs_ftruncate,
+	.fallocate = fisopfs_fallocate,
 	.utimens = fisopfs_utimens,
 	.destroy = fisopfs_destroy,
 	.flush = fisopfs_flush,
+	.fsync = fisopfs_fsync,
+	.fsyncdir = fisopfs_fsync,
 	.chown = fisopfs_chown,
 	.chmod = fisopfs_chmod,
+	.statfs = fisopfs_statfs,
 };
 
 int
 main(int argc, char *argv[])
 {
-	for (int i = 1; i < argc - 1; i++) {
-		if (strcmp(argv[i], "--filedisk") == 0) {
-			filedisk = argv[i + 1];
-			// We remove the argument so that fuse doesn't use our
-			// argument or name as folder.
-			// Equivalent to a pop.
-			for (int j = i; j < argc - 1; j++) {
-				argv[j] = argv[j + 2];
-			}
-			argc = argc - 2;
-			break;
-		}
+	if (fs_parse_args(&argc, argv, &filedisk) != EXIT_SUCCESS) {
+		return EXIT_FAILURE;
 	}
 	return fuse_main(argc, argv, &operations, NULL);
-}
\ No newline at end of file
+}
@@ -0,0 +1,808 @@
+#define FUSE_USE_VERSION 30
+#define _GNU_SOURCE
+#include <stddef.h>
+#include <fuse_lowlevel.h>
+#include "fs.h"
+
+// Same filesystem as fisopfs.c served through the low-level FUSE API: the
+// kernel names inodes by number (index + ROOT_INO) instead of by path, so
+// only lookup resolves names, one component at a time.
+
+#define DEFAULT_TIMEOUT 1.0 // Seconds the kernel caches entries and attributes
+#define CACHE_OPTION(templ, field) { templ, offsetof(cache_options_t, field), 1 }
+
+char *filedisk = DEFAULT_FILE_DISK;
+
+// Caching the kernel may do, set with -o like the same options of the
+// high-level API
+typedef struct cache_options {
+	double entry_timeout; // Seconds a name is known to map to its inode
+	double attr_timeout; // Seconds the attributes of an inode are kept
+	double negative_timeout; // Seconds a name is known to be missing
+	int kernel_cache; // Keep the contents of files cached between opens
+	int auto_cache; // Same, as long as the file didn't change meanwhile
+} cache_options_t;
+
+static cache_options_t cache = { .entry_timeout = DEFAULT_TIMEOUT,
+	                         .attr_timeout = DEFAULT_TIMEOUT };
+
+static const struct fuse_opt cache_specs[] = {
+	CACHE_OPTION("entry_timeout=%lf", entry_timeout),
+	CACHE_OPTION("attr_timeout=%lf", attr_timeout),
+	CACHE_OPTION("negative_timeout=%lf", negative_timeout),
+	CACHE_OPTION("kernel_cache", kernel_cache),
+	CACHE_OPTION("auto_cache", auto_cache),
+	FUSE_OPT_END
+};
+
+// Channel to the kernel, for invalidating what it cached
+static struct fuse_chan *channel;
+
+// Index in the inode table of the inode number ino
+static int
+index_of(fuse_ino_t ino)
+{
+	return (int) (ino - ROOT_INO);
+}
+
+// Whether name inside the directory parent is STATS_FILE
+static bool
+is_stats(fuse_ino_t parent, const char *name)
+{
+	return parent == ROOT_INO && strcmp(name, STATS_FILE) == 0;
+}
+
+// Fill e with the inode at index and count the reference the kernel takes
+// when it gets the reply. The inode, or the whole tree, must be locked.
+static void
+fill_entry(int index, struct fuse_entry_param *e)
+{
+	memset(e, 0, sizeof(struct fuse_entry_param));
+	e->ino = index + ROOT_INO;
+	e->generation = fs_generation(index);
+	e->attr_timeout = cache.attr_timeout;
+	e->entry_timeout = cache.entry_timeout;
+	fs_stat(index, &e->attr);
+	fs_lookup_ref(index);
+}
+
+// Reply to the lookup of a missing name. With negative_timeout the reply
+// is an entry with inode 0, which the kernel remembers as missing.
+static void
+reply_missing(fuse_req_t req)
+{
+	if (cache.negative_timeout <= 0) {
+		fuse_reply_err(req, ENOENT);
+		return;
+	}
+	struct fuse_entry_param e;
+	memset(&e, 0, sizeof(struct fuse_entry_param));
+	e.entry_timeout = cache.negative_timeout;
+	fuse_reply_entry(req, &e);
+}
+
+// Drop the attributes of the inode at index the kernel cached, after
+// fisopfs changed them without the kernel asking for it
+static void
+invalidate_attr(int index)
+{
+	if (cache.attr_timeout > 0) {
+		// A negative offset leaves the cached contents alone
+		fuse_lowlevel_notify_inval_inode(channel, index + ROOT_INO, -1, 0);
+	}
+}
+
+static void
+fisopfs_ll_init(void *userdata, struct fuse_conn_info *conn)
+{
+	log_info(LOG_INIT_START);
+	fs_lock_tree(WRITE_LOCK);
+	fs_mount(filedisk);
+	fs_unlock_tree();
+	if (fs_writeback_start(filedisk) != EXIT_SUCCESS) {
+		log_error(ERR_WRITEBACK_START);
+	}
+}
+
+static void
+fisopfs_ll_destroy(void *userdata)
+{
+	log_info(LOG_DESTROY);
+	fs_writeback_stop();
+	fs_lock_tree(WRITE_LOCK);
+	if (fs_checkpoint(filedisk) != 0) {
+		log_error(ERR_SERIALIZE);
+	}
+	fs_unlock_tree();
+}
+
+static void
+fisopfs_ll_lookup(fuse_req_t req, fuse_ino_t parent, const char *name)
+{
+	log_debug(LOG_LL_LOOKUP, parent, name);
+	uint64_t start = stats_start();
+	struct fuse_entry_param e;
+	if (is_stats(parent, name)) {
+		// Never cached, its size changes with every operation
+		memset(&e, 0, sizeof(struct fuse_entry_param));
+		e.ino = STATS_INO;
+		stats_stat(&e.attr);
+		e.attr.st_ino = STATS_INO;
+		stats_done(STAT_LOOKUP, start, EXIT_SUCCESS);
+		fuse_reply_entry(req, &e);
+		return;
+	}
+	fs_lock_tree(READ_LOCK);
+	int index = BAD_INDEX;
+	if (fs_inode_used(index_of(parent))) {
+		index = fs_lookup_child(index_of(parent), name);
+	}
+	if (index == BAD_INDEX) {
+		fs_unlock_tree();
+		stats_done(STAT_LOOKUP, start, -ENOENT);
+		reply_missing(req);
+		return;
+	}
+	fs_lock_inode(index, READ_LOCK);
+	fill_entry(index, &e);
+	fs_unlock(index);
+	stats_done(STAT_LOOKUP, start, EXIT_SUCCESS);
+	fuse_reply_entry(req, &e);
+}
+
+static void
+fisopfs_ll_forget(fuse_req_t req, fuse_ino_t ino, unsigned long nlookup)
+{
+	log_debug(LOG_LL_FORGET, ino, nlookup);
+	fs_forget(index_of(ino), nlookup);
+	fuse_reply_none(req);
+}
+
+static void
+fisopfs_ll_getattr(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi)
+{
+	log_debug(LOG_LL_GETATTR, ino);
+	uint64_t start = stats_start();
+	struct stat st;
+	if (ino == STATS_INO) {
+		stats_stat(&st);
+		st.st_ino = STATS_INO;
+		stats_done(STAT_GETATTR, start, EXIT_SUCCESS);
+		fuse_reply_attr(req, &st, 0);
+		return;
+	}
+	int index = fs_index_lock(index_of(ino), READ_LOCK);
+	if (index == BAD_INDEX) {
+		stats_done(STAT_GETATTR, start, -ENOENT);
+		fuse_reply_err(req, ENOENT);
+		return;
+	}
+	memset(&st, 0, sizeof(struct stat));
+	fs_stat(index, &st);
+	fs_unlock(index);
+	stats_done(STAT_GETATTR, start, EXIT_SUCCESS);
+	fuse_reply_attr(req, &st, cache.attr_timeout);
+}
+
+// Apply the attributes selected by to_set to the inode at index, locked
+// for writing, with the same checks as the chmod, chown, truncate and
+// utimens of fisopfs.c
+static int
+set_attr(int index, const struct fuse_ctx *ctx, struct stat *attr, int to_set)
+{
+	inode_t *inode = fs_inode(index);
+	if ((to_set & FUSE_SET_ATTR_MODE) && ctx->uid != 0 &&
+	    ctx->uid != inode->uid) {
+		return -EPERM;
+	}
+	if ((to_set & (FUSE_SET_ATTR_UID | FUSE_SET_ATTR_GID)) && ctx->uid != 0) {
+		return -EPERM;
+	}
+	if (to_set & FUSE_SET_ATTR_SIZE) {
+		if (attr->st_size > MAX_FILE_SIZE) {
+			log_error(ERR_TRUNC_SIZE);
+			return -EFBIG;
+		}
+		if (inode->type != FILE_TYPE) {
+			log_error(ERR_TRUNC_TYPE);
+			return -EISDIR;
+		}
+		if (inode->uid != ctx->uid) {
+			log_error(ERR_TRUNC_PERM);
+			return -EACCES;
+		}
+		int res = fs_truncate_data(index, attr->st_size);
+		if (res != EXIT_SUCCESS) {
+			log_error(ERR_TRUNC_SPACE);
+			return res;
+		}
+		inode->modification_time = time(NULL);
+	}
+	if (to_set & FUSE_SET_ATTR_MODE) {
+		inode->mode = (inode->mode & ~07777) | (attr->st_mode & 07777);
+	}
+	if (to_set & FUSE_SET_ATTR_UID) {
+		inode->uid = attr->st_uid;
+	}
+	if (to_set & FUSE_SET_ATTR_GID) {
+		inode->gid = attr->st_gid;
+	}
+	if (to_set & FUSE_SET_ATTR_ATIME_NOW) {
+		inode->access_time = time(NULL);
+	} else if (to_set & FUSE_SET_ATTR_ATIME) {
+		inode->access_time = attr->st_atime;
+	}
+	if (to_set & FUSE_SET_ATTR_MTIME_NOW) {
+		inode->modification_time = time(NULL);
+	} else if (to_set & FUSE_SET_ATTR_MTIME) {
+		inode->modification_time = attr->st_mtime;
+	}
+	fs_mark_dirty(index, DIRTY_META);
+	return EXIT_SUCCESS;
+}
+
+static void
+fisopfs_ll_setattr(fuse_req_t req,
+                   fuse_ino_t ino,
+                   struct stat *attr,
+                   int to_set,
+                   struct fuse_file_info *fi)
+{
+	log_debug(LOG_LL_SETATTR, ino, to_set);
+	uint64_t start = stats_start();
+	int index = fs_index_lock(index_of(ino), WRITE_LOCK);
+	if (index == BAD_INDEX) {
+		int res = ino == STATS_INO ? -EACCES : -ENOENT;
+		stats_done(STAT_SETATTR, start, res);
+		fuse_reply_err(req, -res);
+		return;
+	}
+	int res = set_attr(index, fuse_req_ctx(req), attr, to_set);
+	struct stat st;
+	memset(&st, 0, sizeof(struct stat));
+	fs_stat(index, &st);
+	fs_unlock(index);
+	stats_done(STAT_SETATTR, start, res);
+	if (res != EXIT_SUCCESS) {
+		fuse_reply_err(req, -res);
+	} else {
+		fuse_reply_attr(req, &st, cache.attr_timeout);
+	}
+}
+
+static void
+fisopfs_ll_opendir(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi)
+{
+	int index = fs_index_lock(index_of(ino), READ_LOCK);
+	if (index == BAD_INDEX) {
+		fuse_reply_err(req, ENOENT);
+		return;
+	}
+	bool is_dir = fs_inode(index)->type == DIR_TYPE;
+	fs_unlock(index);
+	if (!is_dir) {
+		fuse_reply_err(req, ENOTDIR);
+	} else {
+		fuse_reply_open(req, fi);
+	}
+}
+
+// Reply buffer of a readdir
+typedef struct dir_buf {
+	fuse_req_t req;
+	char *data;
+	size_t size;
+	size_t used;
+} dir_buf_t;
+
+// Add an entry to the reply of a readdir, returns nonzero once the buffer
+// is full. Only the type of the inode is read, which never changes.
+static int
+dir_add(void *ctx, const char *name, int index, off_t next)
+{
+	dir_buf_t *buf = ctx;
+	struct stat st;
+	memset(&st, 0, sizeof(struct stat));
+	st.st_ino = index + ROOT_INO;
+	st.st_mode = fs_inode(index)->type == DIR_TYPE ? __S_IFDIR : __S_IFREG;
+	size_t len = fuse_add_direntry(buf->req,
+	                               buf->data + buf->used,
+	                               buf->size - buf->used,
+	                               name,
+	                               &st,
+	                               next);
+	if (len > buf->size - buf->used) {
+		return 1;
+	}
+	buf->used += len;
+	return 0;
+}
+
+static void
+fisopfs_ll_readdir(fuse_req_t req,
+                   fuse_ino_t ino,
+                   size_t size,
+                   off_t offset,
+                   struct fuse_file_info *fi)
+{
+	log_debug(LOG_LL_READDIR, ino, offset);
+	uint64_t start = stats_start();
+	int index = index_of(ino);
+	dir_buf_t buf = { .req = req, .size = size };
+	buf.data = malloc(size);
+	if (buf.data == NULL) {
+		fuse_reply_err(req, ENOMEM);
+		return;
+	}
+	int res = EXIT_SUCCESS;
+	fs_lock_tree(READ_LOCK);
+	if (!fs_inode_used(index)) {
+		res = -ENOENT;
+	} else if (fs_inode(index)->type != DIR_TYPE) {
+		log_error(ERR_NOT_DIR);
+		res = -ENOTDIR;
+	} else {
+		fs_list_dir(index, offset, dir_add, &buf);
+	}
+	fs_unlock_tree();
+	stats_done(STAT_READDIR, start, res);
+	if (res != EXIT_SUCCESS) {
+		fuse_reply_err(req, -res);
+	} else {
+		fuse_reply_buf(req, buf.data, buf.used);
+	}
+	free(buf.data);
+}
+
+// Create an entry named name inside the directory parent and reply with
+// it, or with the error. Takes the tree for writing.
+static void
+create_entry(fuse_req_t req,
+             fuse_ino_t parent,
+             const char *name,
+             mode_t mode,
+             int type,
+             struct fuse_file_info *fi)
+{
+	uint64_t start = stats_start();
+	int dir = index_of(parent);
+	fs_lock_tree(WRITE_LOCK);
+	int index;
+	if (!fs_inode_used(dir)) {
+		index = -ENOENT;
+	} else if (type == DIR_TYPE && fs_depth(dir) + 1 > MAX_DEPTH) {
+		log_error(ERR_DEPTH);
+		index = -ENAMETOOLONG;
+	} else if (is_stats(parent, name) || fs_lookup_child(dir, name) != BAD_INDEX) {
+		index = -EEXIST;
+	} else {
+		index = fs_create_child(dir, name, mode, type);
+	}
+	struct fuse_entry_param e;
+	if (index >= 0) {
+		fill_entry(index, &e);
+	}
+	fs_unlock_tree();
+	stats_done(type == DIR_TYPE ? STAT_MKDIR : STAT_CREATE,
+	           start,
+	           index < 0 ? index : EXIT_SUCCESS);
+	if (index < 0) {
+		fuse_reply_err(req, -index);
+	} else if (fi != NULL) {
+		fuse_reply_create(req, &e, fi);
+	} else {
+		fuse_reply_entry(req, &e);
+	}
+}
+
+static void
+fisopfs_ll_mkdir(fuse_req_t req, fuse_ino_t parent, const char *name, mode_t mode)
+{
+	log_debug(LOG_LL_MKDIR, parent, name, mode);
+	create_entry(req, parent, name, mode, DIR_TYPE, NULL);
+}
+
+static void
+fisopfs_ll_create(fuse_req_t req,
+                  fuse_ino_t parent,
+                  const char *name,
+                  mode_t mode,
+                  struct fuse_file_info *fi)
+{
+	log_debug(LOG_LL_CREATE, parent, name, mode);
+	create_entry(req, parent, name, mode, FILE_TYPE, fi);
+}
+
+// Remove the entry named name of the directory at dir, with the tree
+// locked for writing
+static int
+remove_entry(fuse_req_t req, int dir, const char *name, int type)
+{
+	int index = BAD_INDEX;
+	if (fs_inode_used(dir)) {
+		index = fs_lookup_child(dir, name);
+	}
+	if (index == BAD_INDEX) {
+		return -ENOENT;
+	}
+	inode_t *inode = fs_inode(index);
+	if (type == FILE_TYPE) {
+		const struct fuse_ctx *ctx = fuse_req_ctx(req);
+		if (inode->type != FILE_TYPE) {
+			log_error(ERR_UNLINK_TYPE);
+			return -EISDIR;
+		}
+		if (ctx->uid != 0 && inode->uid != ctx->uid) {
+			log_error(ERR_UNLINK_PERM);
+			return -EACCES;
+		}
+	} else {
+		if (inode->type != DIR_TYPE) {
+			log_error(ERR_NOT_DIR_RMDIR);
+			return -ENOTDIR;
+		}
+		if (inode->first_child != BAD_INDEX) {
+			log_error(ERR_NOT_EMPTY);
+			return -ENOTEMPTY;
+		}
+	}
+	fs_remove_entry(index);
+	return EXIT_SUCCESS;
+}
+
+static void
+fisopfs_ll_unlink(fuse_req_t req, fuse_ino_t parent, const char *name)
+{
+	log_debug(LOG_LL_UNLINK, parent, name);
+	uint64_t start = stats_start();
+	fs_lock_tree(WRITE_LOCK);
+	int res = is_stats(parent, name)
+	                  ? -EACCES
+	                  : remove_entry(req, index_of(parent), name, FILE_TYPE);
+	fs_unlock_tree();
+	stats_done(STAT_UNLINK, start, res);
+	fuse_reply_err(req, -res);
+}
+
+static void
+fisopfs_ll_rmdir(fuse_req_t req, fuse_ino_t parent, const char *name)
+{
+	log_debug(LOG_LL_RMDIR, parent, name);
+	uint64_t start = stats_start();
+	fs_lock_tree(WRITE_LOCK);
+	int res = is_stats(parent, name)
+	                  ? -ENOTDIR
+	                  : remove_entry(req, index_of(parent), name, DIR_TYPE);
+	fs_unlock_tree();
+	stats_done(STAT_RMDIR, start, res);
+	fuse_reply_err(req, -res);
+}
+
+static void
+fisopfs_ll_rename(fuse_req_t req,
+                  fuse_ino_t parent,
+                  const char *name,
+                  fuse_ino_t newparent,
+                  const char *newname)
+{
+	log_debug(LOG_LL_RENAME, parent, name, newparent, newname);
+	uint64_t start = stats_start();
+	fs_lock_tree(WRITE_LOCK);
+	int index = BAD_INDEX;
+	if (fs_inode_used(index_of(parent))) {
+		index = fs_lookup_child(index_of(parent), name);
+	}
+	int res = -ENOENT;
+	if (is_stats(parent, name) || is_stats(newparent, newname)) {
+		res = -EACCES;
+	} else if (index != BAD_INDEX && fs_inode_used(index_of(newparent))) {
+		res = fs_rename(index, index_of(newparent), newname, 0);
+	}
+	fs_unlock_tree();
+	stats_done(STAT_RENAME, start, res);
+	fuse_reply_err(req, -res);
+}
+
+static void
+fisopfs_ll_open(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi)
+{
+	log_debug(LOG_LL_OPEN, ino);
+	uint64_t start = stats_start();
+	if (ino == STATS_INO) {
+		// Only for reading, and each read formats the statistics anew
+		int res = (fi->flags & O_ACCMODE) != O_RDONLY ? -EACCES : EXIT_SUCCESS;
+		stats_done(STAT_OPEN, start, res);
+		fi->direct_io = 1;
+		if (res != EXIT_SUCCESS) {
+			fuse_reply_err(req, -res);
+		} else {
+			fuse_reply_open(req, fi);
+		}
+		return;
+	}
+	int index = fs_index_lock(index_of(ino), READ_LOCK);
+	if (index == BAD_INDEX) {
+		stats_done(STAT_OPEN, start, -ENOENT);
+		fuse_reply_err(req, ENOENT);
+		return;
+	}
+	bool is_file = fs_inode(index)->type == FILE_TYPE;
+	fs_unlock(index);
+	stats_done(STAT_OPEN, start, is_file ? EXIT_SUCCESS : -EISDIR);
+	if (!is_file) {
+		fuse_reply_err(req, EISDIR);
+		return;
+	}
+	// Files only change through the kernel, which keeps its cache up to
+	// date, so auto_cache never finds a file changed behind its back
+	fi->keep_cache = cache.kernel_cache || cache.auto_cache;
+	fuse_reply_open(req, fi);
+}
+
+static void
+fisopfs_ll_read(fuse_req_t req,
+                fuse_ino_t ino,
+                size_t size,
+                off_t offset,
+                struct fuse_file_info *fi)
+{
+	log_debug(LOG_LL_READ, ino, offset, size);
+	uint64_t start = stats_start();
+	if (ino == STATS_INO) {
+		char *buffer = malloc(size);
+		if (buffer == NULL) {
+			fuse_reply_err(req, ENOMEM);
+			return;
+		}
+		size_t len = stats_read(buffer, size, offset);
+		stats_done(STAT_READ, start, len);
+		fuse_reply_buf(req, buffer, len);
+		free(buffer);
+		return;
+	}
+	// The reply points at the file itself instead of a copy of it
+	struct iovec *segments = malloc(FS_SEGMENTS(size) * sizeof(struct iovec));
+	if (segments == NULL) {
+		fuse_reply_err(req, ENOMEM);
+		return;
+	}
+	int index = fs_index_lock(index_of(ino), READ_LOCK);
+	if (index == BAD_INDEX) {
+		free(segments);
+		stats_done(STAT_READ, start, -ENOENT);
+		fuse_reply_err(req, ENOENT);
+		return;
+	}
+	inode_t *inode = fs_inode(index);
+	ssize_t len = -EISDIR;
+	int count = 0;
+	bool accessed = false;
+	if (inode->type == FILE_TYPE) {
+		len = fs_read_segments(index, segments, &count, size, offset);
+		accessed = fs_mark_read(index);
+	}
+	stats_done(STAT_READ, start, len);
+	if (len < 0) {
+		fuse_reply_err(req, -len);
+	} else {
+		// Sent before unlocking, the segments point into the file
+		fuse_reply_iov(req, segments, count);
+	}
+	fs_unlock(index);
+	free(segments);
+	if (accessed) {
+		// Only when the access time moved, not on every read
+		invalidate_attr(index);
+	}
+}
+
+// Write to the file at index, locked for writing
+static ssize_t
+write_file(fuse_req_t req, int index, struct fuse_bufvec *buffer, size_t size, off_t offset)
+{
+	inode_t *inode = fs_inode(index);
+	if (inode->type != FILE_TYPE) {
+		log_error(ERR_WRITE_TYPE);
+		return -EISDIR;
+	}
+	if (offset + size > MAX_FILE_SIZE) {
+		log_error(ERR_WRITE_SIZE);
+		return -EFBIG;
+	}
+	if (inode->uid != fuse_req_ctx(req)->uid) {
+		log_error(ERR_WRITE_PERM);
+		return -EACCES;
+	}
+	ssize_t written = fs_write_bufvec(index, buffer, size, offset);
+	if (written < 0) {
+		log_error(ERR_WRITE_SPACE);
+		return written;
+	}
+	inode->access_time = time(NULL);
+	inode->modification_time = time(NULL);
+	return written;
+}
+
+// With splice_read the bytes come in a pipe, which fuse reads straight
+// into the blocks of the file
+static void
+fisopfs_ll_write_buf(fuse_req_t req,
+                     fuse_ino_t ino,
+                     struct fuse_bufvec *buffer,
+                     off_t offset,
+                     struct fuse_file_info *fi)
+{
+	size_t size = fuse_buf_size(buffer);
+	log_debug(LOG_LL_WRITE, ino, size, offset);
+	uint64_t start = stats_start();
+	int index = fs_index_lock(index_of(ino), WRITE_LOCK);
+	if (index == BAD_INDEX) {
+		stats_done(STAT_WRITE, start, -ENOENT);
+		fuse_reply_err(req, ENOENT);
+		return;
+	}
+	ssize_t res = write_file(req, index, buffer, size, offset);
+	fs_unlock(index);
+	stats_done(STAT_WRITE, start, res);
+	if (res < 0) {
+		fuse_reply_err(req, -res);
+	} else {
+		fuse_reply_write(req, res);
+	}
+}
+
+static void
+fisopfs_ll_fallocate(fuse_req_t req,
+                     fuse_ino_t ino,
+                     int mode,
+                     off_t offset,
+                     off_t length,
+                     struct fuse_file_info *fi)
+{
+	log_debug(LOG_LL_FALLOCATE, ino, mode, offset, length);
+	uint64_t start = stats_start();
+	if (ino == STATS_INO) {
+		stats_done(STAT_FALLOCATE, start, -EACCES);
+		fuse_reply_err(req, EACCES);
+		return;
+	}
+	int index = fs_index_lock(index_of(ino), WRITE_LOCK);
+	if (index == BAD_INDEX) {
+		stats_done(STAT_FALLOCATE, start, -ENOENT);
+		fuse_reply_err(req, ENOENT);
+		return;
+	}
+	inode_t *inode = fs_inode(index);
+	int res;
+	if (inode->type != FILE_TYPE) {
+		log_error(ERR_TRUNC_TYPE);
+		res = -EISDIR;
+	} else if (inode->uid != fuse_req_ctx(req)->uid) {
+		log_error(ERR_TRUNC_PERM);
+		res = -EACCES;
+	} else {
+		res = fs_fallocate_data(index, mode, offset, length);
+	}
+	if (res == EXIT_SUCCESS) {
+		inode->modification_time = time(NULL);
+	}
+	fs_unlock(index);
+	stats_done(STAT_FALLOCATE, start, res);
+	fuse_reply_err(req, -res);
+}
+
+static void
+fisopfs_ll_flush(fuse_req_t req, fuse_ino_t ino, struct fuse_file_info *fi)
+{
+	log_debug(LOG_LL_FLUSH, ino);
+	uint64_t start = stats_start();
+	if (fs_writeback_enabled()) {
+		// Left to the flusher thread, fsync is the way to wait for it
+		stats_done(STAT_FLUSH, start, EXIT_SUCCESS);
+		fuse_reply_err(req, 0);
+		return;
+	}
+	fs_lock_tree(WRITE_LOCK);
+	int res = fs_flush(filedisk);
+	fs_unlock_tree();
+	stats_done(STAT_FLUSH, start, res != 0 ? -EIO : EXIT_SUCCESS);
+	if (res != 0) {
+		log_error(ERR_FLUSH);
+		fuse_reply_err(req, EIO);
+		return;
+	}
+	fuse_reply_err(req, 0);
+}
+
+// Every change so far is made durable, the journal is shared by the whole
+// filesystem. Also used for fsyncdir.
+static void
+fisopfs_ll_fsync(fuse_req_t req,
+                 fuse_ino_t ino,
+                 int datasync,
+                 struct fuse_file_info *fi)
+{
+	log_debug(LOG_LL_FSYNC, ino);
+	uint64_t start = stats_start();
+	fs_lock_tree(WRITE_LOCK);
+	int res = fs_sync(filedisk);
+	fs_unlock_tree();
+	stats_done(STAT_FSYNC, start, res != 0 ? -EIO : EXIT_SUCCESS);
+	if (res != 0) {
+		log_error(ERR_FSYNC);
+		fuse_reply_err(req, EIO);
+		return;
+	}
+	fuse_reply_err(req, 0);
+}
+
+static void
+fisopfs_ll_statfs(fuse_req_t req, fuse_ino_t ino)
+{
+	struct statvfs st;
+	fs_lock_tree(READ_LOCK);
+	fs_statfs(&st);
+	fs_unlock_tree();
+	fuse_reply_statfs(req, &st);
+}
+
+static struct fuse_lowlevel_ops operations = {
+	.init = fisopfs_ll_init,
+	.destroy = fisopfs_ll_destroy,
+	.lookup = fisopfs_ll_lookup,
+	.forget = fisopfs_ll_forget,
+	.getattr = fisopfs_ll_getattr,
+	.setattr = fisopfs_ll_setattr,
+	.opendir = fisopfs_ll_opendir,
+	.readdir = fisopfs_ll_readdir,
+	.mkdir = fisopfs_ll_mkdir,
+	.create = fisopfs_ll_create,
+	.unlink = fisopfs_ll_unlink,
+	.rmdir = fisopfs_ll_rmdir,
+	.rename = fisopfs_ll_rename,
+	.open = fisopfs_ll_open,
+	.read = fisopfs_ll_read,
+	.write_buf = fisopfs_ll_write_buf,
+	.fallocate = fisopfs_ll_fallocate,
+	.flush = fisopfs_ll_flush,
+	.fsync = fisopfs_ll_fsync,
+	.fsyncdir = fisopfs_ll_fsync,
+	.statfs = fisopfs_ll_statfs,
+};
+
+int
+main(int argc, char *argv[])
+{
+	if (fs_parse_args(&argc, argv, &filedisk) != EXIT_SUCCESS) {
+		return EXIT_FAILURE;
+	}
+	struct fuse_args args = FUSE_ARGS_INIT(argc, argv);
+	char *mountpoint;
+	int multithreaded, foreground;
+	if (fuse_opt_parse(&args, &cache, cache_specs, NULL) != 0 ||
+	    fuse_parse_cmdline(&args, &mountpoint, &multithreaded, &foreground) != 0) {
+		return EXIT_FAILURE;
+	}
+	int res = FS_ERROR;
+	struct fuse_chan *ch = fuse_mount(mountpoint, &args);
+	channel = ch;
+	if (ch != NULL) {
+		struct fuse_session *se =
+		        fuse_lowlevel_new(&args, &operations, sizeof(operations), NULL);
+		if (se != NULL) {
+			if (fuse_set_signal_handlers(se) == 0) {
+				fuse_session_add_chan(se, ch);
+				fuse_daemonize(foreground);
+				res = multithreaded ? fuse_session_loop_mt(se)
+				                    : fuse_session_loop(se);
+				fuse_remove_signal_handlers(se);
+				fuse_session_remove_chan(ch);
+			}
+			fuse_session_destroy(se);
+		}
+		fuse_unmount(mountpoint, ch);
+	}
+	free(mountpoint);
+	fuse_opt_free_args(&args);
+	return res == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
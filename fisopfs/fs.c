@@ -1,183 +1,2862 @@
+#define _GNU_SOURCE
 #include "fs.h"
+#include "hash.h"
 
 filesystem_t fs;
 
-// Search for a free inode slot in the filesystem
+// In-memory state of each inode, in chunks allocated along with the ones
+// of the inode table, not persisted.
+static inode_state_t *state_chunks[MAX_INODE_CHUNKS];
+
+// Entry index by (parent, name): buckets chained through index_next,
+// not persisted. Grows with the inode table.
+static int *index_buckets;
+static size_t index_buckets_amount;
+
+// Inodes changed since the last flush, journaled by fs_flush.
+static int *dirty_list;
+static size_t dirty_amount;
+
+// Whether file data should live in a mapped blocks file (--mmap).
+static bool use_mmap;
+
+// Whether checkpoints past JOURNAL_CHECKPOINT_SIZE are written by a forked
+// child (--bg-checkpoint).
+static bool background_checkpoints;
+
+// Child writing a background checkpoint, NO_CHILD if none, and the read
+// end of the pipe where it sends its checkpoint_report_t.
+static pid_t checkpoint_child = NO_CHILD;
+static int checkpoint_pipe = -1;
+
+// Write-back mode (--writeback): flushes on close do nothing and a flusher
+// thread journals the dirty inodes every writeback_interval seconds, or as
+// soon as writeback_dirty of them are waiting.
+static bool writeback;
+static int writeback_interval = WRITEBACK_INTERVAL;
+static size_t writeback_dirty = WRITEBACK_DIRTY;
+static bool flusher_running;
+static pthread_t flusher;
+static const char *flusher_filename;
+
+// Image the filesystem was loaded from, kept open to read the contents of
+// files the first time they are needed. -1 if there is none.
+static int image_fd = -1;
+
+// Whether images are written through the LZ codec (--compress), and
+// whether the one at image_fd was.
+static bool compress_images;
+static bool image_compressed;
+
+// Whether blocks with the same contents are kept once (--dedup), and
+// whether the image at image_fd was written that way.
+static bool dedup_blocks;
+static bool image_dedup;
+
+// Shared blocks already in the image being written, so each is stored once:
+// what identifies the block (its id, or where it was in the image it is
+// copied from) and where its bytes went. Open addressing, key 0 is empty.
+typedef struct image_ref {
+	uint64_t key;
+	uint64_t offset;
+} image_ref_t;
+static image_ref_t *image_refs;
+static size_t image_refs_capacity;
+static size_t image_refs_amount;
+
+// Read in place of the holes of a file, by the journal and by readers
+// that don't copy
+static const char zero_block[FS_BLOCK_SIZE];
+
+// Every bitmap word before this one is full, not persisted.
+static size_t free_hint;
+
+// Lock order: tree_lock, then one inode lock, then load_lock, then
+// dirty_lock.
+// tree_lock is held for reading by every operation and for writing by the
+// ones that change directory structure or persist the whole filesystem, so
+// the index, names, child lists and the size of the inode table only
+// change with no one else inside.
+static pthread_rwlock_t tree_lock = PTHREAD_RWLOCK_INITIALIZER;
+// Serializes loading file contents from the image, which readers of the
+// same file holding only a read lock may try at once.
+static pthread_mutex_t load_lock = PTHREAD_MUTEX_INITIALIZER;
+// Guards the dirty list, marked from operations holding a read lock.
+static pthread_mutex_t dirty_lock = PTHREAD_MUTEX_INITIALIZER;
+// Wakes the flusher, with dirty_lock held, once writeback_dirty inodes
+// are dirty or when it must stop.
+static pthread_cond_t flusher_wake = PTHREAD_COND_INITIALIZER;
+
+// In-memory state of the inode at index
+static inode_state_t *
+state(int index)
+{
+	return &state_chunks[index >> INODE_CHUNK_BITS][index & (INODE_CHUNK - 1)];
+}
+
+// Add a chunk of free inodes to the inode table
+static int
+table_grow()
+{
+	size_t chunk = fs.inodes_capacity / INODE_CHUNK;
+	if (chunk == MAX_INODE_CHUNKS) {
+		return FS_ERROR;
+	}
+	size_t capacity = fs.inodes_capacity + INODE_CHUNK;
+	size_t words = capacity / BITMAP_WORD_BITS;
+	uint64_t *bitmap = realloc(fs.inodes_bitmap, words * sizeof(uint64_t));
+	if (bitmap == NULL) {
+		return FS_ERROR;
+	}
+	fs.inodes_bitmap = bitmap;
+	memset(bitmap + words - BITMAP_CHUNK_WORDS,
+	       0,
+	       BITMAP_CHUNK_WORDS * sizeof(uint64_t));
+	int *list = realloc(dirty_list, capacity * sizeof(int));
+	if (list == NULL) {
+		return FS_ERROR;
+	}
+	dirty_list = list;
+	inode_t *inodes = calloc(INODE_CHUNK, sizeof(inode_t));
+	inode_state_t *states = calloc(INODE_CHUNK, sizeof(inode_state_t));
+	if (inodes == NULL || states == NULL) {
+		free(inodes);
+		free(states);
+		return FS_ERROR;
+	}
+	for (int i = 0; i < INODE_CHUNK; i++) {
+		states[i].index_next = BAD_INDEX;
+		pthread_rwlock_init(&states[i].lock, NULL);
+	}
+	fs.inode_chunks[chunk] = inodes;
+	state_chunks[chunk] = states;
+	fs.inodes_capacity = capacity;
+	if (index_buckets_amount < capacity) {
+		return fs_index_rebuild();
+	}
+	return EXIT_SUCCESS;
+}
+
+// Grow the inode table until it holds at least capacity inodes
+static int
+table_reserve(size_t capacity)
+{
+	while (fs.inodes_capacity < capacity) {
+		if (table_grow() != EXIT_SUCCESS) {
+			return FS_ERROR;
+		}
+	}
+	return EXIT_SUCCESS;
+}
+
+// Release the inode table, along with the contents of every file
+static void
+table_reset()
+{
+	for (size_t chunk = 0; chunk < fs.inodes_capacity / INODE_CHUNK; chunk++) {
+		for (int i = 0; i < INODE_CHUNK; i++) {
+			free(state_chunks[chunk][i].data.blocks);
+			free(state_chunks[chunk][i].data.inline_data);
+			pthread_rwlock_destroy(&state_chunks[chunk][i].lock);
+		}
+		free(state_chunks[chunk]);
+		free(fs.inode_chunks[chunk]);
+		state_chunks[chunk] = NULL;
+	}
+	free(fs.inodes_bitmap);
+	free(dirty_list);
+	free(index_buckets);
+	memset(&fs, 0, sizeof(filesystem_t));
+	dirty_list = NULL;
+	dirty_amount = 0;
+	index_buckets = NULL;
+	index_buckets_amount = 0;
+	free_hint = 0;
+}
+
+// Whether the inode slot at index is in use
+static bool
+inode_used(int index)
+{
+	return fs.inodes_bitmap[index / BITMAP_WORD_BITS] &
+	       ((uint64_t) 1 << (index % BITMAP_WORD_BITS));
+}
+
+static void
+bitmap_set(int index)
+{
+	fs.inodes_bitmap[index / BITMAP_WORD_BITS] |=
+	        (uint64_t) 1 << (index % BITMAP_WORD_BITS);
+}
+
+static void
+bitmap_clear(int index)
+{
+	fs.inodes_bitmap[index / BITMAP_WORD_BITS] &=
+	        ~((uint64_t) 1 << (index % BITMAP_WORD_BITS));
+	if ((size_t) index / BITMAP_WORD_BITS < free_hint) {
+		free_hint = index / BITMAP_WORD_BITS;
+	}
+}
+
+// Search for a free inode slot in the filesystem, a word of the bitmap at
+// a time starting from the first one that may have a free slot. Free slots
+// the kernel still holds references to are skipped. The table grows when
+// every slot is in use.
+static int
+find_free_inode_slot()
+{
+	size_t words = fs.inodes_capacity / BITMAP_WORD_BITS;
+	bool hinted = false;
+	for (size_t w = free_hint; w < words; w++) {
+		uint64_t free_bits = ~fs.inodes_bitmap[w];
+		if (free_bits != 0 && !hinted) {
+			free_hint = w;
+			hinted = true;
+		}
+		for (; free_bits != 0; free_bits &= free_bits - 1) {
+			int index = w * BITMAP_WORD_BITS + __builtin_ctzll(free_bits);
+			if (__atomic_load_n(&state(index)->lookups, __ATOMIC_RELAXED) == 0) {
+				return index;
+			}
+		}
+	}
+	if (!hinted) {
+		free_hint = words;
+	}
+	if (table_grow() != EXIT_SUCCESS) {
+		return BAD_INDEX;
+	}
+	return words * BITMAP_WORD_BITS;
+}
+
+// Hash of a directory entry
+static unsigned int
+entry_hash(int parent, name_id_t name)
+{
+	unsigned int hash = (unsigned int) parent * INDEX_PARENT_MIX;
+	hash ^= name * INDEX_NAME_MIX;
+	return (hash ^ (hash >> 16)) & (index_buckets_amount - 1);
+}
+
+// Add the inode at index to the entry index
+static void
+index_insert(int index)
+{
+	inode_t *inode = fs_inode(index);
+	unsigned int bucket = entry_hash(inode->parent, inode->name);
+	state(index)->index_next = index_buckets[bucket];
+	index_buckets[bucket] = index;
+}
+
+// Remove the inode at index from the entry index
+static void
+index_remove(int index)
+{
+	inode_t *inode = fs_inode(index);
+	int *link = &index_buckets[entry_hash(inode->parent, inode->name)];
+	while (*link != BAD_INDEX) {
+		if (*link == index) {
+			*link = state(index)->index_next;
+			state(index)->index_next = BAD_INDEX;
+			return;
+		}
+		link = &state(*link)->index_next;
+	}
+}
+
+// Find the entry with the given name id inside parent
+static int
+index_find(int parent, name_id_t name)
+{
+	int index = index_buckets[entry_hash(parent, name)];
+	while (index != BAD_INDEX) {
+		if (fs_inode(index)->parent == parent &&
+		    fs_inode(index)->name == name) {
+			return index;
+		}
+		index = state(index)->index_next;
+	}
+	return BAD_INDEX;
+}
+
+// Rebuild the entry index from the used inodes, with at least a bucket
+// per inode of the table
+int
+fs_index_rebuild()
+{
+	size_t amount = index_buckets_amount ? index_buckets_amount
+	                                     : INDEX_MIN_BUCKETS;
+	while (amount < fs.inodes_capacity) {
+		amount *= 2;
+	}
+	if (amount != index_buckets_amount) {
+		int *buckets = realloc(index_buckets, amount * sizeof(int));
+		if (buckets == NULL) {
+			return FS_ERROR;
+		}
+		index_buckets = buckets;
+		index_buckets_amount = amount;
+	}
+	for (size_t i = 0; i < index_buckets_amount; i++) {
+		index_buckets[i] = BAD_INDEX;
+	}
+	for (size_t i = 0; i < fs.inodes_capacity; i++) {
+		state(i)->index_next = BAD_INDEX;
+		if (inode_used(i) && i != ROOT_INDEX) {
+			index_insert(i);
+		}
+	}
+	return EXIT_SUCCESS;
+}
+
+// Amount of blocks needed to hold size bytes
+static size_t
+blocks_for(off_t size)
+{
+	return (size + FS_BLOCK_SIZE - 1) / FS_BLOCK_SIZE;
+}
+
+// Grow the file to blocks_amount blocks, the new ones holes that read as
+// zeros until written
+static int
+data_reserve(file_data_t *data, size_t blocks_amount)
+{
+	if (blocks_amount > data->blocks_capacity) {
+		size_t capacity = data->blocks_capacity ? data->blocks_capacity
+		                                        : 1;
+		while (capacity < blocks_amount) {
+			capacity *= 2;
+		}
+		block_id_t *blocks =
+		        realloc(data->blocks, capacity * sizeof(block_id_t));
+		if (blocks == NULL) {
+			return -ENOMEM;
+		}
+		data->blocks = blocks;
+		data->blocks_capacity = capacity;
+	}
+	while (data->blocks_amount < blocks_amount) {
+		data->blocks[data->blocks_amount++] = NO_BLOCK;
+	}
+	return EXIT_SUCCESS;
+}
+
+// Release the blocks of the file beyond the first blocks_amount, and with
+// none left its inline contents too
+static void
+data_shrink(file_data_t *data, size_t blocks_amount)
+{
+	while (data->blocks_amount > blocks_amount) {
+		block_id_t id = data->blocks[--data->blocks_amount];
+		if (id != NO_BLOCK) {
+			block_free(id);
+			data->blocks_allocated--;
+		}
+	}
+	if (blocks_amount == 0) {
+		free(data->blocks);
+		data->blocks = NULL;
+		data->blocks_capacity = 0;
+		free(data->inline_data);
+		data->inline_data = NULL;
+		data->inline_capacity = 0;
+	}
+}
+
+// Pointer to the byte at position in the file, NULL inside a hole. *len
+// is set to the bytes available from there up to the end of its block.
+static char *
+data_at(file_data_t *data, off_t position, size_t *len)
+{
+	if (data->inline_data != NULL) {
+		*len = data->inline_capacity - position;
+		return data->inline_data + position;
+	}
+	size_t in_block = position % FS_BLOCK_SIZE;
+	*len = FS_BLOCK_SIZE - in_block;
+	block_id_t id = data->blocks[position / FS_BLOCK_SIZE];
+	return id == NO_BLOCK ? NULL : block_data(id) + in_block;
+}
+
+// Whether blocks are shared by contents: with --dedup, unless the data
+// lives in the mapped blocks file
+static bool
+dedup_active()
+{
+	return dedup_blocks && !blocks_mapped();
+}
+
+// Block b of the file ready to be written: allocated if it is a hole and,
+// if other files share it, copied first. NO_BLOCK when out of memory.
+static block_id_t
+data_fill(file_data_t *data, size_t b)
+{
+	if (data->blocks[b] == NO_BLOCK) {
+		data->blocks[b] = block_alloc();
+		if (data->blocks[b] != NO_BLOCK) {
+			data->blocks_allocated++;
+		}
+	} else if (dedup_active()) {
+		block_id_t id = block_own(data->blocks[b]);
+		if (id == NO_BLOCK) {
+			return NO_BLOCK;
+		}
+		data->blocks[b] = id;
+	}
+	return data->blocks[b];
+}
+
+// Turn the bytes from start to end of the file into zeros, releasing the
+// blocks left with nothing else. Bytes past the size are always zero, so
+// a block is released when nothing before the size is left in it.
+static int
+data_punch(file_data_t *data, off_t start, off_t end, off_t size)
+{
+	if (data->inline_data != NULL) {
+		memset(data->inline_data + start, 0, (end < size ? end : size) - start);
+		return EXIT_SUCCESS;
+	}
+	for (off_t position = start; position < end;) {
+		size_t b = position / FS_BLOCK_SIZE;
+		size_t in_block = position % FS_BLOCK_SIZE;
+		size_t len = FS_BLOCK_SIZE - in_block;
+		if ((off_t) len > end - position) {
+			len = end - position;
+		}
+		block_id_t id = data->blocks[b];
+		if (id != NO_BLOCK && in_block == 0 &&
+		    (len == FS_BLOCK_SIZE || position + (off_t) len >= size)) {
+			block_free(id);
+			data->blocks[b] = NO_BLOCK;
+			data->blocks_allocated--;
+		} else if (id != NO_BLOCK) {
+			id = data_fill(data, b);
+			if (id == NO_BLOCK) {
+				return -ENOSPC;
+			}
+			memset(block_data(id) + in_block, 0, len);
+			block_dirty(id);
+		}
+		position += len;
+	}
+	return EXIT_SUCCESS;
+}
+
+// Whether a file can keep size bytes inline: it has no blocks and its
+// data isn't in the mapped blocks file, where only blocks are saved
+static bool
+inline_fits(const file_data_t *data, off_t size)
+{
+	return size <= FS_INLINE_MAX && data->blocks_amount == 0 && !blocks_mapped();
+}
+
+// Grow the inline buffer of the file to hold size bytes, the new ones zero
+static int
+inline_reserve(file_data_t *data, size_t size)
+{
+	if (size <= data->inline_capacity) {
+		return EXIT_SUCCESS;
+	}
+	size_t capacity = data->inline_capacity ? data->inline_capacity
+	                                        : FS_INLINE_MIN;
+	while (capacity < size) {
+		capacity *= 2;
+	}
+	char *bytes = realloc(data->inline_data, capacity);
+	if (bytes == NULL) {
+		return -ENOMEM;
+	}
+	memset(bytes + data->inline_capacity, 0, capacity - data->inline_capacity);
+	data->inline_data = bytes;
+	data->inline_capacity = capacity;
+	return EXIT_SUCCESS;
+}
+
+// Move the size bytes of an inline file to its first block, before it
+// grows past what is kept inline
+static int
+inline_spill(file_data_t *data, off_t size)
+{
+	if (data->inline_data == NULL) {
+		return EXIT_SUCCESS;
+	}
+	if (size > 0) {
+		if (data_reserve(data, 1) != EXIT_SUCCESS) {
+			return -ENOMEM;
+		}
+		block_id_t id = data_fill(data, 0);
+		if (id == NO_BLOCK) {
+			data->blocks_amount = 0;
+			return -ENOSPC;
+		}
+		memcpy(block_data(id), data->inline_data, size);
+		block_dirty(id);
+	}
+	free(data->inline_data);
+	data->inline_data = NULL;
+	data->inline_capacity = 0;
+	return EXIT_SUCCESS;
+}
+
+// bytes of block b of a file of size bytes that are inside the file
+static size_t
+block_len(off_t size, size_t b)
+{
+	off_t remaining = size - (off_t) b * FS_BLOCK_SIZE;
+	return remaining < FS_BLOCK_SIZE ? remaining : FS_BLOCK_SIZE;
+}
+
+// Read the len bytes of a block from position of the image at fd into
+// buf, checking its checksum if compressed. Returns the bytes it takes in
+// the image, or -1.
+static ssize_t
+image_block_read(int fd, off_t position, char *buf, size_t len, bool compressed)
+{
+	if (!compressed) {
+		return pread(fd, buf, len, position) == (ssize_t) len ? (ssize_t) len : -1;
+	}
+	fs_image_frame_t frame;
+	char stored[FS_BLOCK_SIZE];
+	size_t stored_len = 0;
+	if (pread(fd, &frame, sizeof(frame), position) == sizeof(frame)) {
+		stored_len = frame.len & ~FRAME_RAW;
+	}
+	if (stored_len == 0 || stored_len > sizeof(stored) ||
+	    pread(fd, stored, stored_len, position + sizeof(frame)) !=
+	            (ssize_t) stored_len) {
+		return -1;
+	}
+	if (frame.len & FRAME_RAW) {
+		if (stored_len != len) {
+			return -1;
+		}
+		memcpy(buf, stored, len);
+	} else if (lz_decompress(stored, stored_len, buf, len) != len) {
+		return -1;
+	}
+	if (fnv1a_update(FNV_OFFSET_BASIS, buf, len) != frame.checksum) {
+		return -1;
+	}
+	return sizeof(frame) + stored_len;
+}
+
+// Write the len bytes of a block at buf to the image, compressed with
+// --compress unless that doesn't make them smaller
+static int
+image_block_write(FILE *f, const char *buf, size_t len)
+{
+	if (!compress_images) {
+		return fwrite(buf, len, 1, f) == 1 ? EXIT_SUCCESS : FS_ERROR;
+	}
+	char stored[FS_BLOCK_SIZE];
+	fs_image_frame_t frame = { .checksum = fnv1a_update(FNV_OFFSET_BASIS, buf, len) };
+	frame.len = lz_compress(buf, len, stored, len - 1);
+	const char *payload = stored;
+	if (frame.len == 0) {
+		frame.len = len | FRAME_RAW;
+		payload = buf;
+	}
+	if (fwrite(&frame, sizeof(frame), 1, f) != 1 ||
+	    fwrite(payload, frame.len & ~FRAME_RAW, 1, f) != 1) {
+		return FS_ERROR;
+	}
+	return EXIT_SUCCESS;
+}
+
+// Where the image being written has the bytes of the shared block key, 0
+// if they aren't there yet
+static uint64_t
+image_ref_find(uint64_t key)
+{
+	if (image_refs_capacity == 0) {
+		return 0;
+	}
+	size_t mask = image_refs_capacity - 1;
+	for (size_t i = (key * IMAGE_REFS_MULTIPLIER) >> 32 & mask; image_refs[i].key != 0;
+	     i = (i + 1) & mask) {
+		if (image_refs[i].key == key) {
+			return image_refs[i].offset;
+		}
+	}
+	return 0;
+}
+
+// Remember that the bytes of the shared block key are at offset of the
+// image being written, growing the table past half full
+static int
+image_ref_add(uint64_t key, uint64_t offset)
+{
+	if (2 * (image_refs_amount + 1) > image_refs_capacity) {
+		size_t capacity = image_refs_capacity ? 2 * image_refs_capacity
+		                                      : IMAGE_REFS_INITIAL;
+		image_ref_t *old = image_refs;
+		size_t old_capacity = image_refs_capacity;
+		image_refs = calloc(capacity, sizeof(image_ref_t));
+		if (image_refs == NULL) {
+			image_refs = old;
+			return FS_ERROR;
+		}
+		image_refs_capacity = capacity;
+		image_refs_amount = 0;
+		for (size_t i = 0; i < old_capacity; i++) {
+			if (old[i].key != 0) {
+				image_ref_add(old[i].key, old[i].offset);
+			}
+		}
+		free(old);
+	}
+	size_t mask = image_refs_capacity - 1;
+	size_t i = (key * IMAGE_REFS_MULTIPLIER) >> 32 & mask;
+	while (image_refs[i].key != 0) {
+		i = (i + 1) & mask;
+	}
+	image_refs[i].key = key;
+	image_refs[i].offset = offset;
+	image_refs_amount++;
+	return EXIT_SUCCESS;
+}
+
+// Forget the shared blocks of the image just written
+static void
+image_refs_reset()
+{
+	free(image_refs);
+	image_refs = NULL;
+	image_refs_capacity = 0;
+	image_refs_amount = 0;
+}
+
+// Write a block of a file to the image. With --dedup each block goes after
+// a tag: a block shared with other files (key not 0) is written whole the
+// first time, and then only as where those bytes are.
+static int
+write_image_block(FILE *f, uint64_t key, const char *buf, size_t len)
+{
+	if (!dedup_active()) {
+		return image_block_write(f, buf, len);
+	}
+	uint64_t tag = IMAGE_BLOCK_HERE;
+	if (key != 0) {
+		tag = image_ref_find(key);
+		if (tag == 0) {
+			tag = IMAGE_BLOCK_SHARED;
+			len = FS_BLOCK_SIZE;
+		}
+	}
+	if (fwrite(&tag, sizeof(tag), 1, f) != 1) {
+		return FS_ERROR;
+	}
+	if (tag == IMAGE_BLOCK_SHARED) {
+		long offset = ftell(f);
+		if (offset < 0 || image_ref_add(key, offset) != EXIT_SUCCESS) {
+			return FS_ERROR;
+		}
+	}
+	if (tag == IMAGE_BLOCK_HERE || tag == IMAGE_BLOCK_SHARED) {
+		return image_block_write(f, buf, len);
+	}
+	return EXIT_SUCCESS;
+}
+
+// Read a block of a file from position of the image at image_fd into buf,
+// moving position past it. A block shared with other files is read whole,
+// so buf must fit FS_BLOCK_SIZE bytes, and *key is set to where it is, else
+// to 0 and len bytes are read.
+static int
+read_image_block(off_t *position, char *buf, size_t len, uint64_t *key)
+{
+	uint64_t tag = IMAGE_BLOCK_HERE;
+	if (image_dedup) {
+		if (pread(image_fd, &tag, sizeof(tag), *position) != sizeof(tag)) {
+			return FS_ERROR;
+		}
+		*position += sizeof(tag);
+	}
+	bool here = tag == IMAGE_BLOCK_HERE || tag == IMAGE_BLOCK_SHARED;
+	off_t from = here ? *position : (off_t) tag;
+	*key = tag == IMAGE_BLOCK_HERE ? 0 : (uint64_t) from << 1;
+	ssize_t stored = image_block_read(image_fd,
+	                                  from,
+	                                  buf,
+	                                  tag == IMAGE_BLOCK_HERE ? len : FS_BLOCK_SIZE,
+	                                  image_compressed);
+	if (stored < 0) {
+		return FS_ERROR;
+	}
+	if (here) {
+		*position += stored;
+	}
+	return EXIT_SUCCESS;
+}
+
+// Read the contents of the file at index from where they are in the
+// image: the number of each block that isn't a hole, then their bytes. A
+// file small enough is loaded inline, from its only block. With --dedup
+// each block is shared with any other of the same contents.
+static int
+data_read_image(int index)
+{
+	inode_state_t *st = state(index);
+	file_data_t *data = &st->data;
+	off_t size = fs_inode(index)->size;
+	uint64_t allocated = data->blocks_allocated;
+	uint64_t *numbers = malloc(allocated * sizeof(uint64_t) + 1);
+	if (numbers == NULL) {
+		return FS_ERROR;
+	}
+	off_t position = st->image_offset;
+	size_t len = allocated * sizeof(uint64_t);
+	int res = FS_ERROR;
+	data->blocks_allocated = 0;
+	if (pread(image_fd, numbers, len, position) == (ssize_t) len &&
+	    (inline_fits(data, size) ? inline_reserve(data, size)
+	                             : data_reserve(data, blocks_for(size))) ==
+	            EXIT_SUCCESS) {
+		res = EXIT_SUCCESS;
+		position += len;
+	}
+	for (uint64_t k = 0; k < allocated && res == EXIT_SUCCESS; k++) {
+		uint64_t b = numbers[k];
+		bool in_block = data->inline_data == NULL;
+		if (in_block ? b >= data->blocks_amount || data->blocks[b] != NO_BLOCK ||
+		                       data_fill(data, b) == NO_BLOCK
+		             : b != 0) {
+			res = FS_ERROR;
+			break;
+		}
+		// An inline file is read through buffer, a shared block is whole
+		char buffer[FS_BLOCK_SIZE];
+		uint64_t key;
+		res = read_image_block(&position,
+		                       in_block ? block_data(data->blocks[b]) : buffer,
+		                       block_len(size, b),
+		                       &key);
+		if (!in_block) {
+			memcpy(data->inline_data, buffer, block_len(size, b));
+		} else if (dedup_active()) {
+			data->blocks[b] = block_dedup(data->blocks[b]);
+		}
+	}
+	free(numbers);
+	if (res != EXIT_SUCCESS) {
+		// Left as it was, to be tried again
+		data_shrink(data, 0);
+		data->blocks_allocated = allocated;
+	}
+	return res;
+}
+
+// Load the contents of the file at index from the image the first time
+// they are needed. The inode must be locked, for reading is enough.
+static int
+data_load(int index)
+{
+	inode_state_t *st = state(index);
+	if (__atomic_load_n(&st->image_offset, __ATOMIC_ACQUIRE) == 0) {
+		return EXIT_SUCCESS;
+	}
+	pthread_mutex_lock(&load_lock);
+	int res = EXIT_SUCCESS;
+	if (st->image_offset != 0) {
+		res = data_read_image(index);
+		if (res == EXIT_SUCCESS) {
+			__atomic_store_n(&st->image_offset, 0, __ATOMIC_RELEASE);
+		}
+	}
+	pthread_mutex_unlock(&load_lock);
+	if (res != EXIT_SUCCESS) {
+		log_error(ERR_FS_LOAD, index + ROOT_INO);
+	}
+	return res;
+}
+
+// Release the contents of the file at index, loaded or not
+static void
+data_drop(int index)
+{
+	data_shrink(&state(index)->data, 0);
+	state(index)->data.blocks_allocated = 0;
+	state(index)->image_offset = 0;
+}
+
+// Whether the len bytes at buf are all zero
+static bool
+all_zeros(const char *buf, size_t len)
+{
+	return len == 0 || (buf[0] == 0 && memcmp(buf, buf + 1, len - 1) == 0);
+}
+
+// Forget every pending change
+static void
+dirty_reset()
+{
+	for (size_t i = 0; i < dirty_amount; i++) {
+		state(dirty_list[i])->dirty.flags = 0;
+	}
+	dirty_amount = 0;
+}
+
+// Release every inode, with its contents and name
+static void
+data_reset()
+{
+	if (image_fd >= 0) {
+		close(image_fd);
+		image_fd = -1;
+	}
+	table_reset();
+	blocks_reset();
+	names_reset();
+}
+
+// Initialize an inode with default values
+void
+init_inode(inode_t *inode, int type)
+{
+	memset(inode, 0, sizeof(inode_t));
+	inode->size = 0;
+	inode->uid = getuid();
+	inode->gid = getgid();
+	inode->type = type;
+	inode->mode =
+	        (type == FILE_TYPE) ? (__S_IFREG | 0644) : (__S_IFDIR | 0755);
+	inode->access_time = inode->modification_time = inode->creation_time =
+	        time(NULL);
+	inode->nlink = (type == FILE_TYPE) ? MIN_FILE_NLINKS : MIN_DIR_NLINKS;
+	inode->name = NO_NAME;
+	inode->parent = BAD_INDEX;
+	inode->first_child = BAD_INDEX;
+	inode->next_sibling = BAD_INDEX;
+	inode->prev_sibling = BAD_INDEX;
+}
+
+// Add (or take away) the directory at index, along with the directories
+// below it, to the counts of the directories above it. Walks at most
+// MAX_DEPTH ancestors, however much the directory holds.
+static void
+count_dirs_above(int index, bool add)
+{
+	if (fs_inode(index)->type != DIR_TYPE) {
+		return;
+	}
+	// Directories of the subtree 0, 1... levels below index
+	uint32_t levels[MAX_DEPTH] = { 1 };
+	for (int k = 1; k < MAX_DEPTH; k++) {
+		levels[k] = state(index)->dirs_below[k - 1];
+	}
+	int dir = index;
+	for (int distance = 0; distance < MAX_DEPTH && dir != ROOT_INDEX; distance++) {
+		dir = fs_inode(dir)->parent;
+		uint32_t *below = state(dir)->dirs_below;
+		for (int k = 0; distance + k < MAX_DEPTH; k++) {
+			below[distance + k] = add ? below[distance + k] + levels[k]
+			                          : below[distance + k] - levels[k];
+		}
+	}
+}
+
+// Count the directories below every directory loaded from the image
+static void
+count_all_dirs()
+{
+	for (size_t i = 0; i < fs.inodes_capacity; i++) {
+		memset(state(i)->dirs_below, 0, sizeof(state(i)->dirs_below));
+	}
+	for (size_t i = 0; i < fs.inodes_capacity; i++) {
+		if (!inode_used(i) || i == ROOT_INDEX || fs_inode(i)->type != DIR_TYPE) {
+			continue;
+		}
+		int dir = i;
+		for (int distance = 0; distance < MAX_DEPTH && dir != ROOT_INDEX; distance++) {
+			dir = fs_inode(dir)->parent;
+			state(dir)->dirs_below[distance]++;
+		}
+	}
+}
+
+// Link the inode at index as the first entry of its parent directory, so
+// the sequence numbers of the entries decrease along the list
+static void
+link_child(int index)
+{
+	inode_t *inode = fs_inode(index);
+	inode_t *parent = fs_inode(inode->parent);
+	inode->prev_sibling = BAD_INDEX;
+	inode->next_sibling = parent->first_child;
+	state(index)->seq = ++state(inode->parent)->next_seq;
+	if (parent->first_child != BAD_INDEX) {
+		fs_inode(parent->first_child)->prev_sibling = index;
+		fs_mark_dirty(parent->first_child, DIRTY_META);
+	}
+	parent->first_child = index;
+	fs_mark_dirty(inode->parent, DIRTY_META);
+	count_dirs_above(index, true);
+}
+
+// Unlink the inode at index from its parent directory entries
+static void
+unlink_child(int index)
+{
+	inode_t *inode = fs_inode(index);
+	if (inode->prev_sibling != BAD_INDEX) {
+		fs_inode(inode->prev_sibling)->next_sibling = inode->next_sibling;
+		fs_mark_dirty(inode->prev_sibling, DIRTY_META);
+	} else {
+		fs_inode(inode->parent)->first_child = inode->next_sibling;
+		fs_mark_dirty(inode->parent, DIRTY_META);
+	}
+	if (inode->next_sibling != BAD_INDEX) {
+		fs_inode(inode->next_sibling)->prev_sibling = inode->prev_sibling;
+		fs_mark_dirty(inode->next_sibling, DIRTY_META);
+	}
+	inode->next_sibling = inode->prev_sibling = BAD_INDEX;
+	count_dirs_above(index, false);
+}
+
+// Add an inode (with its parent and name already set) to the filesystem
+int
+fs_add_inode(inode_t *inode)
+{
+	int parent = inode->parent;
+	int index = index_find(parent, inode->name);
+	if (index != BAD_INDEX) {
+		name_release(inode->name);
+		fs_inode(index)->nlink++;
+		return index;
+	}
+	index = find_free_inode_slot();
+	if (index == BAD_INDEX)
+		return BAD_INDEX;
+	*fs_inode(index) = *inode;
+	bitmap_set(index);
+	fs.inodes_amount++;
+	fs_mark_dirty(index, DIRTY_META);
+	index_insert(index);
+	link_child(index);
+	modify_nlink(parent, true);
+	return index;
+}
+
+// Modify the nlink count of the inode at index
+void
+modify_nlink(int index, bool add)
+{
+	if (add) {
+		fs_inode(index)->nlink += 1;
+	} else if (fs_inode(index)->nlink > 0) {
+		fs_inode(index)->nlink -= 1;
+	}
+	fs_mark_dirty(index, DIRTY_META);
+}
+
+// create a new entry in the filesystem, returns its index or a negative
+// errno
+int
+fs_create_entry(const char *path, mode_t mode, int type)
+{
+	log_debug(LOG_ENTRY, path, mode, type);
+	const char *name;
+	int parent = fs_lookup_parent(path, &name);
+	if (parent == BAD_INDEX) {
+		return -ENOENT;
+	}
+	return fs_create_child(parent, name, mode, type);
+}
+
+// create an entry named name inside the directory at parent, returns its
+// index or a negative errno
+int
+fs_create_child(int parent, const char *name, mode_t mode, int type)
+{
+	if (fs_free_inodes() == 0) {
+		log_error(ERR_CREATE_INODE);
+		return -ENOMEM;
+	}
+	if (strlen(name) > MAX_NAME_LEN) {
+		log_error(ERR_CREATE_NAME);
+		return -ENAMETOOLONG;
+	}
+	if (fs_inode(parent)->type != DIR_TYPE) {
+		return -ENOTDIR;
+	}
+	inode_t inode;
+	init_inode(&inode, type);
+	inode.parent = parent;
+	inode.name = name_intern(name);
+	if (inode.name == NO_NAME) {
+		return -ENOMEM;
+	}
+	int index = fs_add_inode(&inode);
+	if (index == BAD_INDEX) {
+		name_release(inode.name);
+		return -ENOSPC;
+	}
+	return index;
+}
+
+// remove the inode at index from the filesystem
+void
+fs_remove_entry(int index)
+{
+	inode_t *inode = fs_inode(index);
+	index_remove(index);
+	unlink_child(index);
+	bitmap_clear(index);
+	fs.inodes_amount--;
+	modify_nlink(inode->parent, false);
+	data_drop(index);
+	name_release(inode->name);
+	memset(inode, 0, sizeof(inode_t));
+	state(index)->generation++;
+	fs_mark_dirty(index, DIRTY_DATA);
+	state(index)->dirty.shrink_to = 0;
+	state(index)->dirty.from = state(index)->dirty.to = 0;
+}
+
+// Take the entry at index out of its parent directory and the entry index
+static void
+detach_entry(int index)
+{
+	index_remove(index);
+	unlink_child(index);
+	modify_nlink(fs_inode(index)->parent, false);
+}
+
+// Put the entry at index, with its new parent and name already set, back
+// in its parent directory and the entry index
+static void
+attach_entry(int index)
+{
+	index_insert(index);
+	link_child(index);
+	modify_nlink(fs_inode(index)->parent, true);
+	fs_mark_dirty(index, DIRTY_META);
+}
+
+// Whether the directory at dir is index or lies somewhere below it
+static bool
+is_inside(int dir, int index)
+{
+	for (; dir != ROOT_INDEX; dir = fs_inode(dir)->parent) {
+		if (dir == index) {
+			return true;
+		}
+	}
+	return index == ROOT_INDEX;
+}
+
+// Levels of directories below the directory at dir, 0 if it has none
+static int
+subtree_height(int dir)
+{
+	int height = MAX_DEPTH;
+	while (height > 0 && state(dir)->dirs_below[height - 1] == 0) {
+		height--;
+	}
+	return height;
+}
+
+// Check that the entry at index can take the place of target (BAD_INDEX
+// if there is none) inside the directory at parent. A directory moved
+// there can't leave any directory below it deeper than MAX_DEPTH.
+static int
+rename_check(int index, int parent, int target)
+{
+	inode_t *inode = fs_inode(index);
+	if (inode->type == DIR_TYPE && is_inside(parent, index)) {
+		return -EINVAL;
+	}
+	if (inode->type == DIR_TYPE &&
+	    fs_depth(parent) + 1 + subtree_height(index) > MAX_DEPTH) {
+		log_error(ERR_DEPTH);
+		return -ENAMETOOLONG;
+	}
+	if (target == BAD_INDEX) {
+		return EXIT_SUCCESS;
+	}
+	if (inode->type == DIR_TYPE && fs_inode(target)->type != DIR_TYPE) {
+		return -ENOTDIR;
+	}
+	if (inode->type != DIR_TYPE && fs_inode(target)->type == DIR_TYPE) {
+		return -EISDIR;
+	}
+	return EXIT_SUCCESS;
+}
+
+// move the entry at index to be named name inside the directory at parent.
+// What was there is replaced, unless flags has RENAME_NOREPLACE, or swapped
+// with the entry at index with RENAME_EXCHANGE. Only the entries involved
+// are relinked, however much a moved directory holds, and they keep their
+// inode numbers. The tree must be locked for writing.
+int
+fs_rename(int index, int parent, const char *name, unsigned int flags)
+{
+	if ((flags & ~(RENAME_NOREPLACE | RENAME_EXCHANGE)) != 0 ||
+	    flags == (RENAME_NOREPLACE | RENAME_EXCHANGE)) {
+		return -EINVAL;
+	}
+	if (index == ROOT_INDEX) {
+		return -EBUSY;
+	}
+	if (strlen(name) > MAX_NAME_LEN) {
+		log_error(ERR_CREATE_NAME);
+		return -ENAMETOOLONG;
+	}
+	if (fs_inode(parent)->type != DIR_TYPE) {
+		return -ENOTDIR;
+	}
+	inode_t *inode = fs_inode(index);
+	int target = fs_lookup_child(parent, name);
+	if (target == index) {
+		return EXIT_SUCCESS;
+	}
+	if (target != BAD_INDEX && (flags & RENAME_NOREPLACE)) {
+		return -EEXIST;
+	}
+	if (flags & RENAME_EXCHANGE) {
+		if (target == BAD_INDEX) {
+			return -ENOENT;
+		}
+		int res = rename_check(index, parent, BAD_INDEX);
+		if (res == EXIT_SUCCESS) {
+			res = rename_check(target, inode->parent, BAD_INDEX);
+		}
+		if (res != EXIT_SUCCESS) {
+			return res;
+		}
+		detach_entry(index);
+		detach_entry(target);
+		inode_t *other = fs_inode(target);
+		other->parent = inode->parent;
+		inode->parent = parent;
+		name_id_t other_name = other->name;
+		other->name = inode->name;
+		inode->name = other_name;
+		attach_entry(index);
+		attach_entry(target);
+		return EXIT_SUCCESS;
+	}
+	int res = rename_check(index, parent, target);
+	if (res != EXIT_SUCCESS) {
+		return res;
+	}
+	if (target != BAD_INDEX && fs_inode(target)->first_child != BAD_INDEX) {
+		return -ENOTEMPTY;
+	}
+	name_id_t id = name_intern(name);
+	if (id == NO_NAME) {
+		return -ENOMEM;
+	}
+	if (target != BAD_INDEX) {
+		fs_remove_entry(target);
+	}
+	detach_entry(index);
+	name_release(inode->name);
+	inode->name = id;
+	inode->parent = parent;
+	attach_entry(index);
+	return EXIT_SUCCESS;
+}
+
+// depth of the entry at index, the root has depth 0
+int
+fs_depth(int index)
+{
+	int depth = 0;
+	for (; index != ROOT_INDEX; index = fs_inode(index)->parent) {
+		depth++;
+	}
+	return depth;
+}
+
+// Number the entries of every directory loaded from the image in the
+// order of their lists, as if they were linked from the last one
+static void
+number_entries()
+{
+	for (size_t dir = 0; dir < fs.inodes_capacity; dir++) {
+		if (!inode_used(dir) || fs_inode(dir)->type != DIR_TYPE) {
+			continue;
+		}
+		uint32_t amount = 0;
+		int index = fs_inode(dir)->first_child;
+		for (; index != BAD_INDEX; index = fs_inode(index)->next_sibling) {
+			amount++;
+		}
+		state(dir)->next_seq = amount;
+		index = fs_inode(dir)->first_child;
+		for (; index != BAD_INDEX; index = fs_inode(index)->next_sibling) {
+			state(index)->seq = amount--;
+		}
+	}
+}
+
+// readdir offset resuming a listing at the entry at index. It keeps the
+// sequence number of the entry, the index is only where to look first.
+static off_t
+dir_cookie(int index)
+{
+	if (index == BAD_INDEX) {
+		return DIR_COOKIE_END;
+	}
+	off_t seq = state(index)->seq & DIR_COOKIE_SEQ;
+	return seq << HANDLE_GENERATION_SHIFT | (index + DIR_COOKIE_BASE);
+}
+
+// First entry of the directory at dir that the listing left at offset goes
+// on with: the entry of the offset if it is still there, otherwise the
+// first one linked before it
+static int
+dir_resume(int dir, off_t offset)
+{
+	int index = (int) (uint32_t) offset - DIR_COOKIE_BASE;
+	if (fs_inode_used(index) && fs_inode(index)->parent == dir &&
+	    dir_cookie(index) == offset) {
+		return index;
+	}
+	uint32_t seq = offset >> HANDLE_GENERATION_SHIFT;
+	index = fs_inode(dir)->first_child;
+	while (index != BAD_INDEX && (state(index)->seq & DIR_COOKIE_SEQ) > seq) {
+		index = fs_inode(index)->next_sibling;
+	}
+	return index;
+}
+
+// list the directory at dir from offset (0 for the start), passing fill
+// each entry with the offset that resumes after it, until fill asks to
+// stop. Entries created or renamed meanwhile may be missed, but the others
+// are listed once even across calls, also when the entry an offset
+// resumes at was removed since. The tree must be locked.
+void
+fs_list_dir(int dir, off_t offset, fs_dir_filler_t fill, void *ctx)
+{
+	if (offset == 0) {
+		if (fill(ctx, ".", dir, DIR_COOKIE_DOTDOT) != 0) {
+			return;
+		}
+		offset = DIR_COOKIE_DOTDOT;
+	}
+	if (offset == DIR_COOKIE_DOTDOT) {
+		int parent = (dir == ROOT_INDEX) ? ROOT_INDEX : fs_inode(dir)->parent;
+		if (fill(ctx, "..", parent, DIR_COOKIE_CHILDREN) != 0) {
+			return;
+		}
+		offset = DIR_COOKIE_CHILDREN;
+	}
+	if (offset == DIR_COOKIE_END) {
+		return;
+	}
+	int index = (offset == DIR_COOKIE_CHILDREN) ? fs_inode(dir)->first_child
+	                                            : dir_resume(dir, offset);
+	for (; index != BAD_INDEX; index = fs_inode(index)->next_sibling) {
+		off_t next = dir_cookie(fs_inode(index)->next_sibling);
+		if (fill(ctx, fs_name(index), index, next) != 0) {
+			return;
+		}
+	}
+}
+
+// read up to size bytes of the file at index starting at offset
+ssize_t
+fs_read_data(int index, char *buffer, size_t size, off_t offset)
+{
+	inode_t *inode = fs_inode(index);
+	if (offset >= inode->size) {
+		return NO_DATA_READ;
+	}
+	if (size > inode->size - offset) {
+		size = inode->size - offset;
+	}
+	if (data_load(index) != EXIT_SUCCESS) {
+		return -EIO;
+	}
+	file_data_t *data = &state(index)->data;
+	size_t done = 0;
+	while (done < size) {
+		size_t len;
+		char *from = data_at(data, offset + done, &len);
+		if (len > size - done) {
+			len = size - done;
+		}
+		if (from == NULL) {
+			memset(buffer + done, 0, len);
+		} else {
+			memcpy(buffer + done, from, len);
+		}
+		done += len;
+	}
+	return done;
+}
+
+// point segments at up to size bytes of the file at index starting at
+// offset, where they are: its blocks, its inline contents or zeros for its
+// holes, so they can be sent without copying them. segments must have room
+// for FS_SEGMENTS(size), *count is set to how many were used. They point
+// there while the inode stays locked. Returns the bytes, or an error.
+ssize_t
+fs_read_segments(int index, struct iovec *segments, int *count, size_t size, off_t offset)
+{
+	inode_t *inode = fs_inode(index);
+	*count = 0;
+	if (offset >= inode->size) {
+		return NO_DATA_READ;
+	}
+	if (size > inode->size - offset) {
+		size = inode->size - offset;
+	}
+	if (data_load(index) != EXIT_SUCCESS) {
+		return -EIO;
+	}
+	file_data_t *data = &state(index)->data;
+	size_t done = 0;
+	while (done < size) {
+		size_t len;
+		char *from = data_at(data, offset + done, &len);
+		if (len > size - done) {
+			len = size - done;
+		}
+		segments[*count].iov_base = from ? from : (char *) zero_block;
+		segments[*count].iov_len = len;
+		(*count)++;
+		done += len;
+	}
+	return done;
+}
+
+// add the bytes from start to end of the file at index to the range
+// changed since the last flush
+static void
+dirty_range(int index, off_t start, off_t end)
+{
+	dirty_inode_t *changes = &state(index)->dirty;
+	if (changes->from == changes->to) {
+		changes->from = start;
+		changes->to = end;
+	} else {
+		if (start < changes->from) {
+			changes->from = start;
+		}
+		if (end > changes->to) {
+			changes->to = end;
+		}
+	}
+}
+
+// copy len bytes to to from what is being written: from buffer after the
+// done bytes already written, or if it is NULL from what is left of src.
+// Returns the bytes copied, fewer if src ran out or failed.
+static size_t
+copy_in(char *to, size_t len, const char *buffer, size_t done, struct fuse_bufvec *src)
+{
+	if (buffer != NULL) {
+		memcpy(to, buffer + done, len);
+		return len;
+	}
+	struct fuse_bufvec dst = FUSE_BUFVEC_INIT(len);
+	dst.buf[0].mem = to;
+	ssize_t copied = fuse_buf_copy(&dst, src, 0);
+	return copied < 0 ? 0 : copied;
+}
+
+// write size bytes, from buffer or else src, to the file at index starting
+// at offset. Only the blocks written to are allocated, a gap before offset
+// is left as a hole; a small file is written inline instead.
+static ssize_t
+write_data(int index, const char *buffer, struct fuse_bufvec *src, size_t size, off_t offset)
+{
+	inode_t *inode = fs_inode(index);
+	file_data_t *data = &state(index)->data;
+	if (data_load(index) != EXIT_SUCCESS) {
+		return -EIO;
+	}
+	off_t end = offset + size;
+	if (inline_fits(data, end > inode->size ? end : inode->size)) {
+		int res = inline_reserve(data, end);
+		if (res != EXIT_SUCCESS) {
+			return res;
+		}
+		fs_mark_dirty(index, DIRTY_DATA);
+		size_t copied = copy_in(data->inline_data + offset, size, buffer, 0, src);
+		if (copied < size) {
+			return -EIO;
+		}
+		if (inode->size < end) {
+			inode->size = end;
+		}
+		dirty_range(index, offset, end);
+		return size;
+	}
+	int res = inline_spill(data, inode->size);
+	if (res == EXIT_SUCCESS) {
+		res = data_reserve(data, blocks_for(end));
+	}
+	if (res != EXIT_SUCCESS) {
+		return res;
+	}
+	fs_mark_dirty(index, DIRTY_DATA);
+	res = -ENOSPC;
+	size_t done = 0;
+	while (done < size) {
+		size_t b = (offset + done) / FS_BLOCK_SIZE;
+		block_id_t id = data_fill(data, b);
+		if (id == NO_BLOCK) {
+			break;
+		}
+		size_t len;
+		char *to = data_at(data, offset + done, &len);
+		if (len > size - done) {
+			len = size - done;
+		}
+		size_t copied = copy_in(to, len, buffer, done, src);
+		block_dirty(id);
+		done += copied;
+		if (copied < len) {
+			res = -EIO;
+			break;
+		}
+	}
+	if (done > 0 && inode->size < offset + done) {
+		inode->size = offset + done;
+	}
+	// Blocks past the size are never kept, not even as holes
+	data_shrink(data, blocks_for(inode->size));
+	if (done == 0) {
+		return res;
+	}
+	dirty_range(index, offset, offset + done);
+	return done;
+}
+
+// write size bytes to the file at index starting at offset
+ssize_t
+fs_write_data(int index, const char *buffer, size_t size, off_t offset)
+{
+	return write_data(index, buffer, NULL, size, offset);
+}
+
+// write the size bytes of src to the file at index starting at offset,
+// copied by fuse straight into the blocks of the file. When src is a pipe
+// spliced from the kernel the bytes are read right where they go.
+ssize_t
+fs_write_bufvec(int index, struct fuse_bufvec *src, size_t size, off_t offset)
+{
+	return write_data(index, NULL, src, size, offset);
+}
+
+// change the size of the file at index, new bytes are a hole that reads
+// as zeros
+int
+fs_truncate_data(int index, off_t size)
+{
+	inode_t *inode = fs_inode(index);
+	file_data_t *data = &state(index)->data;
+	if (data_load(index) != EXIT_SUCCESS) {
+		return -EIO;
+	}
+	fs_mark_dirty(index, DIRTY_DATA);
+	if (size < state(index)->dirty.shrink_to) {
+		state(index)->dirty.shrink_to = size;
+	}
+	if (size > 0 && inline_fits(data, size)) {
+		int res = inline_reserve(data, size);
+		if (res != EXIT_SUCCESS) {
+			return res;
+		}
+		// Bytes past the end of a file are always kept zeroed
+		memset(data->inline_data + size, 0, data->inline_capacity - size);
+	} else if (size > inode->size) {
+		int res = inline_spill(data, inode->size);
+		if (res == EXIT_SUCCESS) {
+			res = data_reserve(data, blocks_for(size));
+		}
+		if (res != EXIT_SUCCESS) {
+			return res;
+		}
+	} else {
+		size_t in_block = size % FS_BLOCK_SIZE;
+		block_id_t id = in_block ? data->blocks[size / FS_BLOCK_SIZE]
+		                         : NO_BLOCK;
+		if (id != NO_BLOCK) {
+			// Bytes past the end of a file are always kept zeroed
+			id = data_fill(data, size / FS_BLOCK_SIZE);
+			if (id == NO_BLOCK) {
+				return -ENOSPC;
+			}
+			memset(block_data(id) + in_block, 0, FS_BLOCK_SIZE - in_block);
+			block_dirty(id);
+		}
+		data_shrink(data, blocks_for(size));
+	}
+	inode->size = size;
+	return EXIT_SUCCESS;
+}
+
+// allocate or deallocate len bytes of the file at index from offset, as
+// fallocate(2) with mode. Allocating only grows the file (unless
+// FALLOC_FL_KEEP_SIZE): the new bytes are a hole, which costs nothing
+// until written. No blocks are reserved, so writing there later may still
+// fail with ENOSPC. FALLOC_FL_PUNCH_HOLE turns the range into a hole.
+int
+fs_fallocate_data(int index, int mode, off_t offset, off_t len)
+{
+	inode_t *inode = fs_inode(index);
+	if (offset < 0 || len <= 0) {
+		return -EINVAL;
+	}
+	if (mode & ~(FALLOC_FL_KEEP_SIZE | FALLOC_FL_PUNCH_HOLE)) {
+		return -EOPNOTSUPP;
+	}
+	if (offset + len > MAX_FILE_SIZE) {
+		return -EFBIG;
+	}
+	if (data_load(index) != EXIT_SUCCESS) {
+		return -EIO;
+	}
+	if (!(mode & FALLOC_FL_PUNCH_HOLE)) {
+		if (!(mode & FALLOC_FL_KEEP_SIZE) && offset + len > (off_t) inode->size) {
+			return fs_truncate_data(index, offset + len);
+		}
+		fs_mark_dirty(index, DIRTY_META);
+		return EXIT_SUCCESS;
+	}
+	// Linux only punches holes keeping the size
+	if (!(mode & FALLOC_FL_KEEP_SIZE)) {
+		return -EOPNOTSUPP;
+	}
+	off_t end = offset + len;
+	if (end > (off_t) inode->size) {
+		end = inode->size;
+	}
+	if (offset >= end) {
+		return EXIT_SUCCESS;
+	}
+	fs_mark_dirty(index, DIRTY_DATA);
+	int res = data_punch(&state(index)->data, offset, end, inode->size);
+	dirty_range(index, offset, end);
+	return res;
+}
+
+// search for an entry by name inside the directory at parent
+int
+fs_lookup_child(int parent, const char *name)
+{
+	name_id_t id = name_find(name);
+	if (id == NO_NAME) {
+		return BAD_INDEX;
+	}
+	return index_find(parent, id);
+}
+
+// index of the entry at the first size bytes of path, resolved component
+// by component without copying more than one name at a time
+static int
+lookup_prefix(const char *path, size_t size)
+{
+	int index = ROOT_INDEX;
+	char name[MAX_NAME_LEN + 1];
+	const char *p = path, *stop = path + size;
+	while (index != BAD_INDEX) {
+		while (p < stop && *p == SLASH) {
+			p++;
+		}
+		if (p == stop) {
+			return index;
+		}
+		const char *end = memchr(p, SLASH, stop - p);
+		size_t len = end ? (size_t) (end - p) : (size_t) (stop - p);
+		if (len > MAX_NAME_LEN) {
+			return BAD_INDEX;
+		}
+		memcpy(name, p, len);
+		name[len] = STRING_END;
+		index = fs_lookup_child(index, name);
+		p += len;
+	}
+	return BAD_INDEX;
+}
+
+// search for an inode by its path, one component at a time
+int
+fs_lookup(const char *path)
+{
+	return lookup_prefix(path, strlen(path));
+}
+
+// index of the directory holding the entry at path. name is pointed at the
+// last component inside path itself, so paths longer than any buffer here
+// are fine; BAD_INDEX if that directory doesn't exist.
+int
+fs_lookup_parent(const char *path, const char **name)
+{
+	const char *slash = strrchr(path, SLASH);
+	if (slash == NULL) {
+		*name = path;
+		return ROOT_INDEX;
+	}
+	*name = slash + 1;
+	return lookup_prefix(path, slash - path);
+}
+
+// remember that the inode at index changed since the last flush
+void
+fs_mark_dirty(int index, int flags)
+{
+	pthread_mutex_lock(&dirty_lock);
+	dirty_inode_t *changes = &state(index)->dirty;
+	if (changes->flags == 0) {
+		dirty_list[dirty_amount++] = index;
+		changes->shrink_to = fs_inode(index)->size;
+		changes->from = changes->to = 0;
+		if (writeback && dirty_amount == writeback_dirty) {
+			pthread_cond_signal(&flusher_wake);
+		}
+	}
+	changes->flags |= flags;
+	pthread_mutex_unlock(&dirty_lock);
+}
+
+// record that the file at index, locked at least for reading, was read.
+// Like relatime, the access time only moves when it isn't newer than the
+// last change or is ATIME_INTERVAL old, so a file read over and over is
+// persisted once and not on every read. Returns whether it moved.
+bool
+fs_mark_read(int index)
+{
+	inode_t *inode = fs_inode(index);
+	time_t now = time(NULL);
+	// Concurrent readers of the same file race only on this field
+	time_t accessed = __atomic_load_n(&inode->access_time, __ATOMIC_RELAXED);
+	if (accessed > inode->modification_time &&
+	    accessed > inode->creation_time && now - accessed < ATIME_INTERVAL) {
+		return false;
+	}
+	if (__atomic_exchange_n(&inode->access_time, now, __ATOMIC_RELAXED) == now) {
+		return false;
+	}
+	fs_mark_dirty(index, DIRTY_META);
+	return true;
+}
+
+// lock the directory structure, for writing to change it
+void
+fs_lock_tree(bool write)
+{
+	if (write) {
+		pthread_rwlock_wrlock(&tree_lock);
+	} else {
+		pthread_rwlock_rdlock(&tree_lock);
+	}
+}
+
+void
+fs_unlock_tree()
+{
+	pthread_rwlock_unlock(&tree_lock);
+}
+
+// lock the inode at index, the tree must be already locked
+void
+fs_lock_inode(int index, bool write)
+{
+	if (write) {
+		pthread_rwlock_wrlock(&state(index)->lock);
+	} else {
+		pthread_rwlock_rdlock(&state(index)->lock);
+	}
+}
+
+void
+fs_unlock_inode(int index)
+{
+	pthread_rwlock_unlock(&state(index)->lock);
+}
+
+// search for an inode by its path and lock it, holding the tree for
+// reading so it can't be removed meanwhile. Nothing stays locked when the
+// path doesn't exist.
+int
+fs_lookup_lock(const char *path, bool write)
+{
+	fs_lock_tree(READ_LOCK);
+	int index = fs_lookup(path);
+	if (index == BAD_INDEX) {
+		fs_unlock_tree();
+		return BAD_INDEX;
+	}
+	fs_lock_inode(index, write);
+	return index;
+}
+
+// release the locks taken by fs_lookup_lock
+void
+fs_unlock(int index)
+{
+	fs_unlock_inode(index);
+	fs_unlock_tree();
+}
+
+// lock the inode at index like fs_lookup_lock, for callers that got it
+// from the kernel instead of a path. Nothing stays locked when the slot is
+// not in use.
+int
+fs_index_lock(int index, bool write)
+{
+	fs_lock_tree(READ_LOCK);
+	if (!fs_inode_used(index)) {
+		fs_unlock_tree();
+		return BAD_INDEX;
+	}
+	fs_lock_inode(index, write);
+	return index;
+}
+
+// handle for an open file, the inode number along with the generation of
+// its slot so it stops matching once the file is removed
+uint64_t
+fs_handle(int index)
+{
+	return (uint64_t) state(index)->generation << HANDLE_GENERATION_SHIFT |
+	       (uint32_t) (index + ROOT_INO);
+}
+
+// lock the inode of a handle made by fs_handle like fs_index_lock, or
+// return BAD_INDEX when the file was removed since it was opened
+int
+fs_handle_lock(uint64_t handle, bool write)
+{
+	int index = (int) (uint32_t) handle - ROOT_INO;
+	fs_lock_tree(READ_LOCK);
+	if (!fs_inode_used(index) ||
+	    state(index)->generation != handle >> HANDLE_GENERATION_SHIFT) {
+		fs_unlock_tree();
+		return BAD_INDEX;
+	}
+	fs_lock_inode(index, write);
+	return index;
+}
+
+// whether index is a slot of the inode table holding an inode
+bool
+fs_inode_used(int index)
+{
+	return index >= 0 && (size_t) index < fs.inodes_capacity &&
+	       inode_used(index);
+}
+
+// fill st with the attributes of the inode at index, locked for reading
+void
+fs_stat(int index, struct stat *st)
+{
+	inode_t *inode = fs_inode(index);
+	st->st_dev = 0;
+	st->st_ino = index + ROOT_INO;
+	st->st_uid = inode->uid;
+	st->st_gid = inode->gid;
+	st->st_mode = inode->mode;
+	st->st_nlink = inode->nlink;
+	st->st_size = inode->size;
+	st->st_blocks = state(index)->data.blocks_allocated *
+	                        (FS_BLOCK_SIZE / STAT_BLOCK_SIZE) +
+	                (state(index)->data.inline_capacity + STAT_BLOCK_SIZE - 1) /
+	                        STAT_BLOCK_SIZE;
+	// Reads update the access time holding only a read lock
+	st->st_atime = __atomic_load_n(&inode->access_time, __ATOMIC_RELAXED);
+	st->st_mtime = inode->modification_time;
+	st->st_ctime = inode->creation_time;
+}
+
+// fill st with the usage of the filesystem, with the tree locked. Its size
+// is the blocks in use plus the ones that can still be allocated.
+void
+fs_statfs(struct statvfs *st)
+{
+	memset(st, 0, sizeof(struct statvfs));
+	st->f_bsize = FS_BLOCK_SIZE;
+	st->f_frsize = FS_BLOCK_SIZE;
+	st->f_bfree = blocks_available();
+	st->f_bavail = st->f_bfree;
+	st->f_blocks = blocks_used() + st->f_bfree;
+	st->f_files = MAX_INODES;
+	st->f_ffree = fs_free_inodes();
+	st->f_favail = st->f_ffree;
+	st->f_namemax = MAX_NAME_LEN;
+}
+
+// count a reference the kernel took to the inode at index, with the tree
+// locked so the slot can't be taken meanwhile
+void
+fs_lookup_ref(int index)
+{
+	__atomic_add_fetch(&state(index)->lookups, 1, __ATOMIC_RELAXED);
+}
+
+// drop nlookup references the kernel forgot, once none is left a freed
+// slot can be reused
+void
+fs_forget(int index, uint64_t nlookup)
+{
+	fs_lock_tree(READ_LOCK);
+	if (index >= 0 && (size_t) index < fs.inodes_capacity) {
+		__atomic_sub_fetch(&state(index)->lookups, nlookup, __ATOMIC_RELAXED);
+	}
+	fs_unlock_tree();
+}
+
+// times the slot at index was freed, so a reused inode number is told
+// apart from the inode that had it before
+uint32_t
+fs_generation(int index)
+{
+	return state(index)->generation;
+}
+
+// amount of inodes that can still be created
+size_t
+fs_free_inodes()
+{
+	return MAX_INODES - fs.inodes_amount;
+}
+
+// name of the inode at index, the root is named "/"
+const char *
+fs_name(int index)
+{
+	if (index == ROOT_INDEX) {
+		return SLASH_STR;
+	}
+	return name_get(fs_inode(index)->name);
+}
+
+// initialize the filesystem
+int
+fs_initialize()
+{
+	log_info(LOG_INIT);
+	data_reset();
+	if (table_grow() != EXIT_SUCCESS) {
+		return FS_ERROR;
+	}
+	inode_t root_inode;
+	init_inode(&root_inode, DIR_TYPE);
+	*fs_inode(ROOT_INDEX) = root_inode;
+	bitmap_set(ROOT_INDEX);
+	fs.inodes_amount = 1;
+	return EXIT_SUCCESS;
+}
+
+// choose whether new filesystems keep file data in a mapped blocks file
+void
+fs_set_mmap(bool enabled)
+{
+	use_mmap = enabled;
+}
+
+// choose whether blocks with the same contents are kept once, in memory
+// and in the images written from now on
+void
+fs_set_dedup(bool enabled)
+{
+	dedup_blocks = enabled;
+}
+
+// map the blocks file that goes with the image filename
+static int
+open_blocks(const char *filename)
+{
+	char path[JOURNAL_PATH_MAX];
+	snprintf(path, sizeof(path), "%s%s", filename, BLOCKS_SUFFIX);
+	if (blocks_map_open(path) != 0) {
+		log_error(ERR_FS_BLOCKS, filename, BLOCKS_SUFFIX, strerror(errno));
+		return FS_ERROR;
+	}
+	return EXIT_SUCCESS;
+}
+
+// initialize an empty filesystem and write its first image to filename
+int
+fs_create(const char *filename)
+{
+	if (fs_initialize() != EXIT_SUCCESS) {
+		return FS_ERROR;
+	}
+	if (use_mmap) {
+		if (open_blocks(filename) != EXIT_SUCCESS) {
+			return FS_ERROR;
+		}
+		blocks_map_ready();
+		if (dedup_blocks) {
+			log_info(LOG_DEDUP_IGNORED, filename);
+		}
+	}
+	return fs_checkpoint(filename);
+}
+
+// write the size of the inode table, its bitmap and the used inodes
+static int
+write_table(FILE *f)
+{
+	fs_table_header_t header = { .capacity = fs.inodes_capacity,
+		                     .amount = fs.inodes_amount };
+	size_t words = fs.inodes_capacity / BITMAP_WORD_BITS;
+	if (fwrite(&header, sizeof(header), 1, f) != 1 ||
+	    fwrite(fs.inodes_bitmap, sizeof(uint64_t), words, f) != words) {
+		return FS_ERROR;
+	}
+	for (size_t i = 0; i < fs.inodes_capacity; i++) {
+		if (inode_used(i) && fwrite(fs_inode(i), sizeof(inode_t), 1, f) != 1) {
+			return FS_ERROR;
+		}
+	}
+	return EXIT_SUCCESS;
+}
+
+// read the inode table written by write_table, growing it to its size
+static int
+read_table(FILE *f)
+{
+	fs_table_header_t header;
+	if (fread(&header, sizeof(header), 1, f) != 1 ||
+	    header.capacity % INODE_CHUNK != 0 || header.capacity > MAX_INODES ||
+	    table_reserve(header.capacity) != EXIT_SUCCESS) {
+		return FS_ERROR;
+	}
+	size_t words = fs.inodes_capacity / BITMAP_WORD_BITS;
+	if (fread(fs.inodes_bitmap, sizeof(uint64_t), words, f) != words) {
+		return FS_ERROR;
+	}
+	size_t amount = 0;
+	for (size_t w = 0; w < words; w++) {
+		amount += __builtin_popcountll(fs.inodes_bitmap[w]);
+	}
+	if (amount != header.amount || !inode_used(ROOT_INDEX)) {
+		return FS_ERROR;
+	}
+	fs.inodes_amount = amount;
+	for (size_t i = 0; i < fs.inodes_capacity; i++) {
+		if (inode_used(i) && fread(fs_inode(i), sizeof(inode_t), 1, f) != 1) {
+			return FS_ERROR;
+		}
+	}
+	return EXIT_SUCCESS;
+}
+
+// write the name of every inode after the inode table
+static int
+write_names(FILE *f)
+{
+	for (size_t i = 0; i < fs.inodes_capacity; i++) {
+		if (!inode_used(i) || i == ROOT_INDEX) {
+			continue;
+		}
+		const char *name = name_get(fs_inode(i)->name);
+		uint16_t len = strlen(name);
+		if (fwrite(&len, sizeof(len), 1, f) != 1 ||
+		    fwrite(name, len, 1, f) != 1) {
+			return FS_ERROR;
+		}
+	}
+	return EXIT_SUCCESS;
+}
+
+// read and intern the name of every inode after the inode table
+static int
+read_names(FILE *f)
+{
+	char name[MAX_NAME_LEN + 1];
+	for (size_t i = 0; i < fs.inodes_capacity; i++) {
+		if (!inode_used(i) || i == ROOT_INDEX) {
+			continue;
+		}
+		uint16_t len;
+		if (fread(&len, sizeof(len), 1, f) != 1 || len > MAX_NAME_LEN ||
+		    fread(name, len, 1, f) != 1) {
+			return FS_ERROR;
+		}
+		name[len] = STRING_END;
+		fs_inode(i)->name = name_intern(name);
+		if (fs_inode(i)->name == NO_NAME) {
+			return FS_ERROR;
+		}
+	}
+	return EXIT_SUCCESS;
+}
+
+// write the block ids of every file after the inode table (mapped images)
+static int
+write_files_blocks(FILE *f)
+{
+	for (size_t i = 0; i < fs.inodes_capacity; i++) {
+		if (!inode_used(i) ||
+		    fs_inode(i)->type != FILE_TYPE) {
+			continue;
+		}
+		uint64_t amount = state(i)->data.blocks_amount;
+		if (fwrite(&amount, sizeof(amount), 1, f) != 1 ||
+		    (amount > 0 &&
+		     fwrite(state(i)->data.blocks, sizeof(block_id_t), amount, f) != amount)) {
+			return FS_ERROR;
+		}
+	}
+	return EXIT_SUCCESS;
+}
+
+// amount of blocks of the file that are not holes
+static size_t
+count_allocated(const file_data_t *data)
+{
+	size_t allocated = 0;
+	for (size_t b = 0; b < data->blocks_amount; b++) {
+		allocated += data->blocks[b] != NO_BLOCK;
+	}
+	return allocated;
+}
+
+// replace the block ids of the file at index, without claiming them
+static int
+set_files_blocks(int index, const block_id_t *ids, uint64_t amount)
+{
+	file_data_t *data = &state(index)->data;
+	free(data->blocks);
+	memset(data, 0, sizeof(file_data_t));
+	if (amount == 0) {
+		return EXIT_SUCCESS;
+	}
+	data->blocks = malloc(amount * sizeof(block_id_t));
+	if (data->blocks == NULL) {
+		return FS_ERROR;
+	}
+	memcpy(data->blocks, ids, amount * sizeof(block_id_t));
+	data->blocks_amount = data->blocks_capacity = amount;
+	data->blocks_allocated = count_allocated(data);
+	return EXIT_SUCCESS;
+}
+
+// read the block ids of every file after the inode table (mapped images)
+static int
+read_files_blocks(FILE *f)
+{
+	for (size_t i = 0; i < fs.inodes_capacity; i++) {
+		if (!inode_used(i) ||
+		    fs_inode(i)->type != FILE_TYPE) {
+			continue;
+		}
+		uint64_t amount;
+		if (fread(&amount, sizeof(amount), 1, f) != 1 ||
+		    amount != blocks_for(fs_inode(i)->size)) {
+			return FS_ERROR;
+		}
+		file_data_t *data = &state(i)->data;
+		data->blocks = malloc(amount * sizeof(block_id_t) + 1);
+		if (data->blocks == NULL ||
+		    fread(data->blocks, sizeof(block_id_t), amount, f) != amount) {
+			return FS_ERROR;
+		}
+		data->blocks_amount = data->blocks_capacity = amount;
+		data->blocks_allocated = count_allocated(data);
+	}
+	return EXIT_SUCCESS;
+}
+
+// claim in the mapped blocks file every block used by a file
+static int
+claim_files_blocks()
+{
+	for (size_t i = 0; i < fs.inodes_capacity; i++) {
+		if (!inode_used(i)) {
+			continue;
+		}
+		for (size_t b = 0; b < state(i)->data.blocks_amount; b++) {
+			block_id_t id = state(i)->data.blocks[b];
+			if (id != NO_BLOCK && block_claim(id) != 0) {
+				return FS_ERROR;
+			}
+		}
+	}
+	blocks_map_ready();
+	return EXIT_SUCCESS;
+}
+
+// copy the contents of the file at index, not loaded yet, from the image
+// it was loaded from. Copied as they are if both images are written the
+// same way without shared blocks, else block by block through the codec
+// and the tags of shared blocks.
+static int
+copy_image_data(FILE *f, int index)
+{
+	char buffer[FS_BLOCK_SIZE];
+	inode_state_t *st = state(index);
+	off_t position = st->image_offset;
+	if (image_compressed == compress_images && !image_dedup && !dedup_active()) {
+		for (uint64_t remaining = st->image_len; remaining > 0;) {
+			size_t len = remaining < sizeof(buffer) ? remaining : sizeof(buffer);
+			if (pread(image_fd, buffer, len, position) != (ssize_t) len ||
+			    fwrite(buffer, len, 1, f) != 1) {
+				return FS_ERROR;
+			}
+			position += len;
+			remaining -= len;
+		}
+		return EXIT_SUCCESS;
+	}
+	off_t size = fs_inode(index)->size;
+	uint64_t allocated = st->data.blocks_allocated;
+	size_t len = allocated * sizeof(uint64_t);
+	uint64_t *numbers = malloc(len + 1);
+	int res = FS_ERROR;
+	if (numbers != NULL && pread(image_fd, numbers, len, position) == (ssize_t) len &&
+	    (len == 0 || fwrite(numbers, len, 1, f) == 1)) {
+		res = EXIT_SUCCESS;
+		position += len;
+	}
+	for (uint64_t k = 0; k < allocated && res == EXIT_SUCCESS; k++) {
+		uint64_t key;
+		if (numbers[k] >= blocks_for(size) ||
+		    read_image_block(&position, buffer, block_len(size, numbers[k]), &key) !=
+		            EXIT_SUCCESS ||
+		    write_image_block(f, key, buffer, block_len(size, numbers[k])) !=
+		            EXIT_SUCCESS) {
+			res = FS_ERROR;
+		}
+	}
+	free(numbers);
+	return res;
+}
+
+// write the contents of the file at index: the number of each block that
+// isn't a hole, then the bytes of each of them. An inline file is written
+// as its first block, a block shared with other files only once.
+static int
+write_file_data(FILE *f, int index)
+{
+	if (state(index)->image_offset != 0) {
+		return copy_image_data(f, index);
+	}
+	file_data_t *data = &state(index)->data;
+	if (data->inline_data != NULL) {
+		uint64_t b = 0;
+		off_t size = fs_inode(index)->size;
+		if (size > 0 && (fwrite(&b, sizeof(b), 1, f) != 1 ||
+		                 write_image_block(f, 0, data->inline_data, size) != EXIT_SUCCESS)) {
+			return FS_ERROR;
+		}
+		return EXIT_SUCCESS;
+	}
+	for (uint64_t b = 0; b < data->blocks_amount; b++) {
+		if (data->blocks[b] != NO_BLOCK && fwrite(&b, sizeof(b), 1, f) != 1) {
+			return FS_ERROR;
+		}
+	}
+	for (uint64_t b = 0; b < data->blocks_amount; b++) {
+		block_id_t id = data->blocks[b];
+		if (id == NO_BLOCK) {
+			continue;
+		}
+		uint64_t key = dedup_active() && block_refs(id) > 1 ? (uint64_t) id << 1 | 1 : 0;
+		if (write_image_block(f, key, block_data(id), block_len(fs_inode(index)->size, b)) !=
+		    EXIT_SUCCESS) {
+			return FS_ERROR;
+		}
+	}
+	return EXIT_SUCCESS;
+}
+
+// write where the contents of each file are in the image, so loading it
+// only reads this far and the contents are read when first needed, and
+// then the contents. How much they take compressed is only known once
+// written, so the extents are filled in afterwards.
 static int
-find_free_inode_slot(filesystem_t *fs)
+write_files_data(FILE *f)
 {
-	for (int i = 0; i < MAX_INODES; i++) {
-		if (fs->inodes_bitmap[i] == NOT_USED_INODE) {
-			return i;
+	size_t files = 0;
+	for (size_t i = 0; i < fs.inodes_capacity; i++) {
+		files += inode_used(i) && fs_inode(i)->type == FILE_TYPE;
+	}
+	fs_file_extent_t *extents = calloc(files + 1, sizeof(fs_file_extent_t));
+	long extents_offset = ftell(f);
+	if (extents == NULL || extents_offset < 0 ||
+	    fwrite(extents, sizeof(fs_file_extent_t), files, f) != files) {
+		free(extents);
+		return FS_ERROR;
+	}
+	int res = EXIT_SUCCESS;
+	fs_file_extent_t *extent = extents;
+	for (size_t i = 0; i < fs.inodes_capacity && res == EXIT_SUCCESS; i++) {
+		if (!inode_used(i) ||
+		    fs_inode(i)->type != FILE_TYPE) {
+			continue;
 		}
+		extent->offset = ftell(f);
+		extent->allocated = state(i)->data.inline_data != NULL
+		                            ? fs_inode(i)->size > 0
+		                            : state(i)->data.blocks_allocated;
+		res = write_file_data(f, i);
+		extent->len = ftell(f) - extent->offset;
+		extent++;
 	}
-	return BAD_INDEX;
+	if (res == EXIT_SUCCESS &&
+	    (fseek(f, extents_offset, SEEK_SET) != 0 ||
+	     fwrite(extents, sizeof(fs_file_extent_t), files, f) != files ||
+	     fseek(f, 0, SEEK_END) != 0)) {
+		res = FS_ERROR;
+	}
+	free(extents);
+	image_refs_reset();
+	return res;
 }
 
-// Extracts the filename from the given path
-void
-extract_filename(const char *path, char *out)
+// write the inode table, the names and, if file data lives in the mapped
+// blocks file, the block ids of every file
+static int
+write_meta_to(FILE *f)
 {
-	const char *slash = strrchr(path, SLASH);
-	if (slash && *(slash + 1) != STRING_END) {
-		strcpy(out, slash + 1);
-	} else if (slash) {
-		strcpy(out, SLASH_STR);
-	} else {
-		strcpy(out, path);
+	if (write_table(f) != EXIT_SUCCESS || write_names(f) != EXIT_SUCCESS ||
+	    (blocks_mapped() && write_files_blocks(f) != EXIT_SUCCESS)) {
+		return FS_ERROR;
+	}
+	return EXIT_SUCCESS;
+}
+
+// write the metadata after the header, with --compress as its length
+// followed by it compressed a block at a time
+static int
+write_meta(FILE *f)
+{
+	if (!compress_images) {
+		return write_meta_to(f);
+	}
+	char *buffer = NULL;
+	size_t len = 0;
+	FILE *m = open_memstream(&buffer, &len);
+	if (m == NULL) {
+		return FS_ERROR;
+	}
+	int res = write_meta_to(m);
+	if (fclose(m) != 0) {
+		res = FS_ERROR;
 	}
+	uint64_t meta_len = len;
+	if (res == EXIT_SUCCESS && fwrite(&meta_len, sizeof(meta_len), 1, f) != 1) {
+		res = FS_ERROR;
+	}
+	for (size_t done = 0; done < len && res == EXIT_SUCCESS; done += FS_BLOCK_SIZE) {
+		size_t block = len - done < FS_BLOCK_SIZE ? len - done : FS_BLOCK_SIZE;
+		res = image_block_write(f, buffer + done, block);
+	}
+	free(buffer);
+	return res;
 }
 
-// Extracts the previous path from the given path
-void
-extract_prev_path(const char *path, char *out)
+// read what write_meta_to wrote
+static int
+read_meta_from(FILE *f, bool mapped)
+{
+	if (read_table(f) != EXIT_SUCCESS || read_names(f) != EXIT_SUCCESS ||
+	    (mapped && read_files_blocks(f) != EXIT_SUCCESS)) {
+		return FS_ERROR;
+	}
+	return EXIT_SUCCESS;
+}
+
+// read what write_meta wrote, uncompressing it into memory first if the
+// image is compressed
+static int
+read_meta(FILE *f, bool mapped, bool compressed)
+{
+	if (!compressed) {
+		return read_meta_from(f, mapped);
+	}
+	uint64_t len;
+	if (fread(&len, sizeof(len), 1, f) != 1 || len == 0 || len > SIZE_MAX / 2) {
+		return FS_ERROR;
+	}
+	char *buffer = malloc(len);
+	off_t position = ftell(f);
+	int res = buffer != NULL && position >= 0 ? EXIT_SUCCESS : FS_ERROR;
+	for (uint64_t done = 0; done < len && res == EXIT_SUCCESS; done += FS_BLOCK_SIZE) {
+		size_t block = len - done < FS_BLOCK_SIZE ? len - done : FS_BLOCK_SIZE;
+		ssize_t stored =
+		        image_block_read(fileno(f), position, buffer + done, block, true);
+		if (stored < 0) {
+			res = FS_ERROR;
+		}
+		position += stored;
+	}
+	FILE *m = NULL;
+	if (res == EXIT_SUCCESS && (fseek(f, position, SEEK_SET) != 0 ||
+	                            (m = fmemopen(buffer, len, BINARY_READ)) == NULL)) {
+		res = FS_ERROR;
+	}
+	if (m != NULL) {
+		res = read_meta_from(m, mapped);
+		fclose(m);
+	}
+	free(buffer);
+	return res;
+}
+
+// read where the contents of every file are in the image, leaving them to
+// be loaded by data_load
+static int
+read_files_extents(FILE *f)
+{
+	for (size_t i = 0; i < fs.inodes_capacity; i++) {
+		if (!inode_used(i) ||
+		    fs_inode(i)->type != FILE_TYPE) {
+			continue;
+		}
+		fs_file_extent_t extent;
+		if (fread(&extent, sizeof(extent), 1, f) != 1 ||
+		    extent.allocated > blocks_for(fs_inode(i)->size) ||
+		    extent.offset == 0) {
+			return FS_ERROR;
+		}
+		if (fs_inode(i)->size > 0) {
+			state(i)->image_offset = extent.offset;
+			state(i)->image_len = extent.len;
+			state(i)->data.blocks_allocated = extent.allocated;
+		}
+	}
+	return EXIT_SUCCESS;
+}
+
+// append a record with the current state of the inode at index
+static int
+journal_inode(int index)
+{
+	if (!inode_used(index)) {
+		if (journal_begin(JOURNAL_OP_FREE, index, 0) != 0) {
+			return FS_ERROR;
+		}
+		return journal_end();
+	}
+	inode_t *inode = fs_inode(index);
+	dirty_inode_t *changes = &state(index)->dirty;
+	const char *name = (index == ROOT_INDEX) ? "" : fs_name(index);
+	uint16_t name_len = strlen(name);
+	uint64_t payload_len = sizeof(inode_t) + sizeof(name_len) + name_len;
+	uint32_t op = JOURNAL_OP_INODE;
+	journal_data_t range = { 0 };
+	uint64_t blocks_amount = state(index)->data.blocks_amount;
+	if ((changes->flags & DIRTY_DATA) && blocks_mapped()) {
+		// The data is already in the mapped file, only its blocks change
+		op = JOURNAL_OP_BLOCKS;
+		payload_len += sizeof(blocks_amount) +
+		               blocks_amount * sizeof(block_id_t);
+	} else if (changes->flags & DIRTY_DATA) {
+		if (data_load(index) != EXIT_SUCCESS) {
+			return FS_ERROR;
+		}
+		op = JOURNAL_OP_DATA;
+		off_t to = changes->to < inode->size ? changes->to : inode->size;
+		range.shrink_to = changes->shrink_to;
+		range.offset = changes->from;
+		range.len = (to > changes->from) ? to - changes->from : 0;
+		payload_len += sizeof(range) + range.len;
+	}
+	if (journal_begin(op, index, payload_len) != 0 ||
+	    journal_write(inode, sizeof(inode_t)) != 0 ||
+	    journal_write(&name_len, sizeof(name_len)) != 0 ||
+	    journal_write(name, name_len) != 0) {
+		return FS_ERROR;
+	}
+	if (op == JOURNAL_OP_BLOCKS) {
+		if (journal_write(&blocks_amount, sizeof(blocks_amount)) != 0 ||
+		    journal_write(state(index)->data.blocks,
+		                  blocks_amount * sizeof(block_id_t)) != 0) {
+			return FS_ERROR;
+		}
+	} else if (op == JOURNAL_OP_DATA) {
+		if (journal_write(&range, sizeof(range)) != 0) {
+			return FS_ERROR;
+		}
+		for (uint64_t done = 0; done < range.len;) {
+			size_t len;
+			char *from = data_at(&state(index)->data, range.offset + done, &len);
+			if (len > range.len - done) {
+				len = range.len - done;
+			}
+			if (journal_write(from ? from : zero_block, len) != 0) {
+				return FS_ERROR;
+			}
+			done += len;
+		}
+	}
+	return journal_end();
+}
+
+// write the data of a journal record to the file at index a block at a
+// time. Holes were journaled as zeros: whole blocks of zeros are made
+// holes again instead of being written.
+static int
+replay_data(int index, const char *buffer, size_t size, off_t offset)
+{
+	inode_t *inode = fs_inode(index);
+	for (size_t done = 0; done < size;) {
+		off_t position = offset + done;
+		size_t len = FS_BLOCK_SIZE - position % FS_BLOCK_SIZE;
+		if (len > size - done) {
+			len = size - done;
+		}
+		if (len == FS_BLOCK_SIZE && all_zeros(buffer + done, len)) {
+			if (position < (off_t) inode->size &&
+			    data_punch(&state(index)->data,
+			               position,
+			               position + len,
+			               inode->size) != EXIT_SUCCESS) {
+				return FS_ERROR;
+			}
+		} else if (fs_write_data(index, buffer + done, len, position) < 0) {
+			return FS_ERROR;
+		}
+		done += len;
+	}
+	return EXIT_SUCCESS;
+}
+
+// apply a record of the journal while loading the filesystem
+static int
+apply_record(uint32_t op, int32_t index, const char *payload, uint64_t len)
 {
-	strcpy(out, path);
-	char *slash = strrchr(out, SLASH);
-	if (slash == NULL || slash == out) {
-		strcpy(out, SLASH_STR);
+	if (index < 0 || index >= MAX_INODES ||
+	    table_reserve((size_t) index + 1) != EXIT_SUCCESS) {
+		return FS_ERROR;
+	}
+	inode_t *inode = fs_inode(index);
+	bool used = inode_used(index);
+	if (op == JOURNAL_OP_FREE) {
+		if (used) {
+			data_drop(index);
+			name_release(inode->name);
+			memset(inode, 0, sizeof(inode_t));
+			bitmap_clear(index);
+			fs.inodes_amount--;
+		}
+		return EXIT_SUCCESS;
+	}
+	inode_t record;
+	uint16_t name_len;
+	char name[MAX_NAME_LEN + 1];
+	if (len < sizeof(record) + sizeof(name_len)) {
+		return FS_ERROR;
+	}
+	memcpy(&record, payload, sizeof(record));
+	memcpy(&name_len, payload + sizeof(record), sizeof(name_len));
+	payload += sizeof(record) + sizeof(name_len);
+	len -= sizeof(record) + sizeof(name_len);
+	if (name_len > MAX_NAME_LEN || name_len > len) {
+		return FS_ERROR;
+	}
+	memcpy(name, payload, name_len);
+	name[name_len] = STRING_END;
+	payload += name_len;
+	len -= name_len;
+
+	record.name = (index == ROOT_INDEX) ? NO_NAME : name_intern(name);
+	if (index != ROOT_INDEX && record.name == NO_NAME) {
+		return FS_ERROR;
+	}
+	if (used && op == JOURNAL_OP_DATA && data_load(index) != EXIT_SUCCESS) {
+		return FS_ERROR;
+	}
+	off_t old_size = used ? inode->size : 0;
+	if (used) {
+		name_release(inode->name);
 	} else {
-		*slash = STRING_END;
+		bitmap_set(index);
+		fs.inodes_amount++;
+	}
+	*inode = record;
+	if (op == JOURNAL_OP_BLOCKS) {
+		uint64_t amount;
+		if (len < sizeof(amount)) {
+			return FS_ERROR;
+		}
+		memcpy(&amount, payload, sizeof(amount));
+		if (amount != blocks_for(record.size) ||
+		    len - sizeof(amount) != amount * sizeof(block_id_t)) {
+			return FS_ERROR;
+		}
+		return set_files_blocks(index,
+		                        (const block_id_t *) (payload + sizeof(amount)),
+		                        amount);
+	}
+	if (op != JOURNAL_OP_DATA) {
+		return EXIT_SUCCESS;
+	}
+	journal_data_t range;
+	if (len < sizeof(range)) {
+		return FS_ERROR;
 	}
+	memcpy(&range, payload, sizeof(range));
+	payload += sizeof(range);
+	if (range.len != len - sizeof(range)) {
+		return FS_ERROR;
+	}
+	// Rebuild the contents: drop what was cut, then add what was written
+	off_t size = record.size;
+	inode->size = old_size;
+	if ((off_t) range.shrink_to < old_size &&
+	    fs_truncate_data(index, range.shrink_to) != EXIT_SUCCESS) {
+		return FS_ERROR;
+	}
+	if (replay_data(index, payload, range.len, range.offset) != EXIT_SUCCESS) {
+		return FS_ERROR;
+	}
+	return fs_truncate_data(index, size);
 }
 
-// Initialize an inode with default values
-void
-init_inode(inode_t *inode,
-           const char *name,
-           const char *path,
-           const char *prev_path,
-           int type)
+// write the filesystem to a temporary file, then rename it over filename,
+// logging what fails if verbose
+static int
+write_image(const char *filename, bool verbose)
 {
-	memset(inode, 0, sizeof(inode_t));
-	inode->size = 0;
-	inode->uid = getuid();
-	inode->gid = getgid();
-	inode->type = type;
-	inode->mode =
-	        (type == FILE_TYPE) ? (__S_IFREG | 0644) : (__S_IFDIR | 0755);
-	inode->access_time = inode->modification_time = inode->creation_time =
-	        time(NULL);
-	inode->nlink = (type == FILE_TYPE) ? MIN_FILE_NLINKS : MIN_DIR_NLINKS;
-	if (name) {
-		strcpy(inode->name, name);
+	char tmp[JOURNAL_PATH_MAX];
+	snprintf(tmp, sizeof(tmp), "%s%s", filename, TMP_SUFFIX);
+	FILE *f = fopen(tmp, BINARY_WRITE);
+	if (f == NULL) {
+		if (verbose) {
+			log_error(ERR_FS_FOPEN, tmp, strerror(errno));
+		}
+		return FS_ERROR;
 	}
-	if (path) {
-		strcpy(inode->path, path);
+	fs_image_header_t header = { .magic = FS_MAGIC,
+		                     .version = FS_VERSION,
+		                     .flags = (blocks_mapped() ? FS_IMAGE_MAPPED : 0) |
+		                              (compress_images ? FS_IMAGE_COMPRESSED : 0) |
+		                              (dedup_active() ? FS_IMAGE_DEDUP : 0) };
+	if (fwrite(&header, sizeof(header), 1, f) != 1 || write_meta(f) != EXIT_SUCCESS ||
+	    (!blocks_mapped() && write_files_data(f) != EXIT_SUCCESS)) {
+		if (verbose) {
+			log_error(ERR_FS_FWRITE, tmp, strerror(errno));
+		}
+		fclose(f);
+		unlink(tmp);
+		return FS_ERROR;
 	}
-	if (prev_path) {
-		strcpy(inode->prev_path, prev_path);
+	// The image must be on the disk before it replaces the old one
+	if (fflush(f) != 0 || fsync(fileno(f)) != 0 || fclose(f) != 0 ||
+	    rename(tmp, filename) != 0) {
+		if (verbose) {
+			log_error(ERR_FS_RENAME, filename, strerror(errno));
+		}
+		unlink(tmp);
+		return FS_ERROR;
 	}
-	memset(inode->data, 0, sizeof(inode->data));
+	return EXIT_SUCCESS;
 }
-// Add an inode to the filesystem
-int
-fs_add_inode(inode_t *inode)
+
+// Wait for the background checkpoint if there is one (or just check on it
+// if !wait) and report it. If it failed the journal set aside stays, to be
+// replayed on load until a checkpoint succeeds.
+static int
+checkpoint_reap(const char *filename, bool wait)
 {
-	int index = find_free_inode_slot(&fs);
-	if (index == BAD_INDEX)
-		return BAD_INDEX;
-	for (int i = 0; i < MAX_INODES; i++) {
-		if (fs.inodes_bitmap[i] == USED_INODE &&
-		    strcmp(fs.inodes[i].name, inode->name) == 0 &&
-		    strcmp(fs.inodes[i].prev_path, inode->prev_path) == 0) {
-			fs.inodes[i].nlink++;
-			return i;
+	if (checkpoint_child == NO_CHILD) {
+		return EXIT_SUCCESS;
+	}
+	int status;
+	pid_t pid = waitpid(checkpoint_child, &status, wait ? 0 : WNOHANG);
+	if (pid == 0) {
+		return EXIT_SUCCESS;
+	}
+	checkpoint_child = NO_CHILD;
+	// The child can't log, it reports what it did before exiting
+	checkpoint_report_t report;
+	ssize_t got = read(checkpoint_pipe, &report, sizeof(report));
+	close(checkpoint_pipe);
+	checkpoint_pipe = -1;
+	if (pid < 0 || !WIFEXITED(status) || WEXITSTATUS(status) != EXIT_SUCCESS ||
+	    got != sizeof(report)) {
+		stats_record(STAT_SERIALIZE, 0, 0, true);
+		log_error(ERR_BG_CHECKPOINT, filename);
+		return FS_ERROR;
+	}
+	journal_remove_old(filename);
+	stats_record(STAT_SERIALIZE, report.ns, report.bytes, false);
+	log_info(LOG_BG_CHECKPOINT,
+	         filename,
+	         (intmax_t) report.bytes,
+	         report.ns / 1e9);
+	return EXIT_SUCCESS;
+}
+
+// Write the image from a forked child, which sees the filesystem as it is
+// now while this process keeps changing its own copy. Records from here on
+// go to a new journal, the current one is set aside until the image is
+// saved. Falls back to fs_checkpoint if the child can't be started, and
+// with --mmap, where the child would share the blocks this process keeps
+// writing and freeing. Needs tree_lock held for writing.
+static int
+checkpoint_background(const char *filename)
+{
+	if (checkpoint_child != NO_CHILD) {
+		return EXIT_SUCCESS;
+	}
+	if (blocks_mapped()) {
+		return fs_checkpoint(filename);
+	}
+	int fds[2];
+	if (pipe2(fds, O_CLOEXEC) != 0) {
+		log_error(ERR_PIPE, filename, strerror(errno));
+		return fs_checkpoint(filename);
+	}
+	// A journal still set aside by a failed checkpoint can't be rotated
+	if (journal_has_old(filename) || journal_rotate(filename) != 0) {
+		close(fds[0]);
+		close(fds[1]);
+		return fs_checkpoint(filename);
+	}
+	// With tree_lock no other thread holds an inode lock or load_lock. The
+	// locks they can still take are held across the fork, so the child
+	// gets them free and what they guard consistent.
+	pthread_mutex_lock(&dirty_lock);
+	blocks_freeze();
+	pid_t pid = fork();
+	if (pid == 0) {
+		// Other threads may have held the log lock when forking: no logs
+		uint64_t start = stats_start();
+		struct stat st;
+		if (write_image(filename, false) != EXIT_SUCCESS ||
+		    stat(filename, &st) != 0) {
+			_exit(EXIT_FAILURE);
 		}
+		checkpoint_report_t report = { .ns = stats_start() - start,
+			                       .bytes = st.st_size };
+		bool sent = write(fds[1], &report, sizeof(report)) == sizeof(report);
+		_exit(sent ? EXIT_SUCCESS : EXIT_FAILURE);
 	}
-	fs.inodes[index] = *inode;
-	fs.inodes_bitmap[index] = USED_INODE;
-	fs.inodes_amount++;
-	return index;
+	blocks_thaw();
+	pthread_mutex_unlock(&dirty_lock);
+	close(fds[1]);
+	if (pid < 0) {
+		close(fds[0]);
+		log_error(ERR_FORK, filename, strerror(errno));
+		return fs_checkpoint(filename);
+	}
+	checkpoint_child = pid;
+	checkpoint_pipe = fds[0];
+	log_info(LOG_BG_CHECKPOINT_START, filename, (intmax_t) pid);
+	return EXIT_SUCCESS;
 }
 
-// Modify the nlink count of an inode at a given path
+// write the filesystem's image from a forked child past
+// JOURNAL_CHECKPOINT_SIZE, instead of holding everyone else back
 void
-modify_nlink_path(const char *path, bool add)
+fs_set_background_checkpoint(bool enabled)
 {
-	int index = fs_lookup(path);
-	if (index < 0) {
+	background_checkpoints = enabled;
+}
+
+// write images a block at a time through the LZ codec, whatever the one
+// loaded was
+void
+fs_set_compress(bool enabled)
+{
+	compress_images = enabled;
+}
+
+// share the blocks written to the file at index since the last flush
+// with indexed blocks of the same contents (--dedup). Blocks left all
+// zeros become holes. Needs tree_lock held for writing, no one else can
+// be using the blocks of the file.
+static void
+dedup_dirty(int index)
+{
+	inode_state_t *st = state(index);
+	dirty_inode_t *changes = &st->dirty;
+	file_data_t *data = &st->data;
+	if (!(changes->flags & DIRTY_DATA) || !inode_used(index) ||
+	    st->image_offset != 0 || changes->from >= changes->to) {
 		return;
 	}
-	if (add) {
-		fs.inodes[index].nlink += 1;
-	} else if (fs.inodes[index].nlink > 0) {
-		fs.inodes[index].nlink -= 1;
+	size_t end = blocks_for(changes->to);
+	if (end > data->blocks_amount) {
+		end = data->blocks_amount;
+	}
+	for (size_t b = changes->from / FS_BLOCK_SIZE; b < end; b++) {
+		block_id_t id = data->blocks[b];
+		if (id == NO_BLOCK) {
+			continue;
+		}
+		if (all_zeros(block_data(id), FS_BLOCK_SIZE)) {
+			block_free(id);
+			data->blocks[b] = NO_BLOCK;
+			data->blocks_allocated--;
+		} else {
+			data->blocks[b] = block_dedup(id);
+		}
+	}
+}
+
+// dedup_dirty every inode changed since the last flush, with --dedup
+static void
+dedup_dirty_all()
+{
+	for (size_t i = 0; i < dirty_amount && dedup_active(); i++) {
+		dedup_dirty(dirty_list[i]);
 	}
 }
 
-// create a new entry in the filesystem
+// journal every inode changed since the last flush
 int
-fs_create_entry(const char *path, mode_t mode, int type)
+fs_flush(const char *filename)
 {
-	printf(LOG_ENTRY, path, mode, type);
-	if (fs.inodes_amount == MAX_INODES) {
-		fprintf(stderr, ERR_CREATE_INODE);
-		return -ENOMEM;
+	checkpoint_reap(filename, false);
+	if (dirty_amount == 0) {
+		return EXIT_SUCCESS;
+	}
+	// Mapped data must reach the disk before the blocks referencing it
+	if (blocks_sync() != 0) {
+		return FS_ERROR;
+	}
+	dedup_dirty_all();
+	size_t journaled = dirty_amount;
+	for (size_t i = 0; i < dirty_amount; i++) {
+		if (journal_inode(dirty_list[i]) != EXIT_SUCCESS) {
+			log_error(ERR_JOURNAL, filename);
+			return fs_checkpoint(filename);
+		}
+	}
+	if (journal_commit() != 0) {
+		log_error(ERR_JOURNAL, filename);
+		return fs_checkpoint(filename);
+	}
+	dirty_reset();
+	log_debug(LOG_JOURNAL_FLUSH, journaled, journal_size());
+	if (journal_size() > JOURNAL_CHECKPOINT_SIZE) {
+		return background_checkpoints ? checkpoint_background(filename)
+		                              : fs_checkpoint(filename);
 	}
-	inode_t inode;
-	char name[MAX_PATH_NAME], prev_path[MAX_PATH_NAME];
-	extract_filename(path, name);
-	extract_prev_path(path, prev_path);
-	init_inode(&inode, name, path, prev_path, type);
-	int index = fs_add_inode(&inode);
-	if (index == BAD_INDEX)
-		return BAD_INDEX;
-	modify_nlink_path(prev_path, true);
 	return EXIT_SUCCESS;
 }
 
-// search for an inode by its path
+// journal every inode changed since the last flush and push the journal
+// to the disk, so everything done so far survives a crash
 int
-fs_lookup(const char *path)
+fs_sync(const char *filename)
 {
-	if (strcmp(path, SLASH_STR) == 0) {
-		return ROOT_INDEX;
+	if (fs_flush(filename) != EXIT_SUCCESS || journal_sync() != 0) {
+		return FS_ERROR;
 	}
-	char name[MAX_PATH_NAME], prev_path[MAX_PATH_NAME];
-	extract_filename(path, name);
-	extract_prev_path(path, prev_path);
-	for (int i = 0; i < MAX_INODES; i++) {
-		if (fs.inodes_bitmap[i] == USED_INODE &&
-		    strcmp(fs.inodes[i].name, name) == 0 &&
-		    strcmp(fs.inodes[i].prev_path, prev_path) == 0) {
-			return i;
+	return EXIT_SUCCESS;
+}
+
+// Body of the flusher thread: flush whenever the interval passes or enough
+// inodes are dirty, until fs_writeback_stop. After a failed flush it waits
+// the whole interval, instead of retrying right away.
+static void *
+flusher_loop(void *arg)
+{
+	bool failed = false;
+	pthread_mutex_lock(&dirty_lock);
+	while (flusher_running) {
+		struct timespec deadline;
+		clock_gettime(CLOCK_REALTIME, &deadline);
+		deadline.tv_sec += writeback_interval;
+		while (flusher_running && (failed || dirty_amount < writeback_dirty) &&
+		       pthread_cond_timedwait(&flusher_wake, &dirty_lock, &deadline) !=
+		               ETIMEDOUT) {
+		}
+		if (!flusher_running) {
+			break;
+		}
+		// tree_lock goes before dirty_lock
+		pthread_mutex_unlock(&dirty_lock);
+		fs_lock_tree(WRITE_LOCK);
+		failed = fs_flush(flusher_filename) != EXIT_SUCCESS;
+		fs_unlock_tree();
+		if (failed) {
+			log_error(ERR_WRITEBACK, flusher_filename);
 		}
+		pthread_mutex_lock(&dirty_lock);
 	}
-	return BAD_INDEX;
+	pthread_mutex_unlock(&dirty_lock);
+	return NULL;
 }
 
-// initialize the filesystem
+// flush from a thread of its own instead of on every close, every
+// interval seconds or once dirty inodes are waiting to be flushed
 void
-fs_initialize()
+fs_set_writeback(int interval, size_t dirty)
 {
-	printf(LOG_INIT);
-	memset(&fs, 0, sizeof(filesystem_t));
-	inode_t root_inode;
-	init_inode(&root_inode, SLASH_STR, SLASH_STR, ROOT_PREV_PATH, DIR_TYPE);
-	fs.inodes[ROOT_INDEX] = root_inode;
-	fs.inodes_bitmap[ROOT_INDEX] = USED_INODE;
-	fs.inodes_amount = 1;
+	writeback = true;
+	writeback_interval = interval;
+	writeback_dirty = dirty;
+}
+
+// whether flushes on close are left to the flusher thread
+bool
+fs_writeback_enabled()
+{
+	return writeback;
 }
 
-// write the filesystem to a file
+// start the flusher thread of filename in write-back mode, once mounted
 int
-fs_serialize(const char *filename)
+fs_writeback_start(const char *filename)
 {
-	FILE *f = fopen(filename, BINARY_WRITE);
-	if (f == NULL) {
-		fprintf(stderr, ERR_FS_FOPEN, filename);
-		perror(NULL);
+	if (!writeback || flusher_running) {
+		return EXIT_SUCCESS;
+	}
+	flusher_filename = filename;
+	flusher_running = true;
+	if (pthread_create(&flusher, NULL, flusher_loop, NULL) != 0) {
+		// Without the thread closing files has to flush again
+		flusher_running = false;
+		writeback = false;
 		return FS_ERROR;
 	}
-	if (fwrite(&fs, sizeof(fs), 1, f) != 1) {
-		fprintf(stderr, ERR_FS_FWRITE, filename);
-		perror(NULL);
-		fclose(f);
+	log_info(LOG_WRITEBACK_START, writeback_interval, writeback_dirty);
+	return EXIT_SUCCESS;
+}
+
+// stop the flusher thread, leaving what it didn't flush to the caller
+void
+fs_writeback_stop()
+{
+	if (!flusher_running) {
+		return;
+	}
+	pthread_mutex_lock(&dirty_lock);
+	flusher_running = false;
+	pthread_cond_signal(&flusher_wake);
+	pthread_mutex_unlock(&dirty_lock);
+	pthread_join(flusher, NULL);
+}
+
+// write the whole filesystem to its image and empty the journal
+int
+fs_checkpoint(const char *filename)
+{
+	checkpoint_reap(filename, true);
+	dedup_dirty_all();
+	if (blocks_sync() != 0 || fs_serialize(filename) != EXIT_SUCCESS) {
 		return FS_ERROR;
 	}
-	fclose(f);
-	printf(LOG_SERIALIZE, filename);
+	// A journal that fails to open or empty is replayed over an image
+	// that already holds its changes, which is harmless.
+	if (journal_open(filename) == 0) {
+		journal_reset();
+	}
+	journal_remove_old(filename);
+	dirty_reset();
+	log_info(LOG_CHECKPOINT, filename);
+	return EXIT_SUCCESS;
+}
+
+// write the filesystem to its image
+int
+fs_serialize(const char *filename)
+{
+	uint64_t start = stats_start();
+	struct stat st;
+	if (write_image(filename, true) != EXIT_SUCCESS || stat(filename, &st) != 0) {
+		stats_done(STAT_SERIALIZE, start, FS_ERROR);
+		return FS_ERROR;
+	}
+	stats_done(STAT_SERIALIZE, start, st.st_size);
+	log_info(LOG_SERIALIZE, filename);
 	return EXIT_SUCCESS;
 }
 
@@ -187,17 +2866,159 @@ fs_deserialize(const char *filename)
 {
 	FILE *f = fopen(filename, BINARY_READ);
 	if (f == NULL) {
-		fprintf(stderr, ERR_FS_FOPEN, filename);
-		perror(NULL);
+		log_error(ERR_FS_FOPEN, filename, strerror(errno));
+		return FS_ERROR;
+	}
+	fs_image_header_t header;
+	if (fread(&header, sizeof(header), 1, f) != 1 ||
+	    header.magic != FS_MAGIC || header.version != FS_VERSION) {
+		log_error(ERR_FS_FORMAT, filename, FS_VERSION);
+		fclose(f);
 		return FS_ERROR;
 	}
-	if (fread(&fs, sizeof(fs), 1, f) != 1) {
-		fprintf(stderr, ERR_FS_FREAD, filename);
-		perror(NULL);
+	// The image decides where file data lives, whatever --mmap says
+	bool mapped = header.flags & FS_IMAGE_MAPPED;
+	if (mapped) {
+		log_info(LOG_MMAP_IMAGE, filename, filename, BLOCKS_SUFFIX);
+	} else if (use_mmap) {
+		log_info(LOG_MMAP_IGNORED, filename);
+	}
+	if (mapped && dedup_blocks) {
+		log_info(LOG_DEDUP_IGNORED, filename);
+	}
+	bool compressed = header.flags & FS_IMAGE_COMPRESSED;
+	if (compressed) {
+		log_info(LOG_COMPRESSED_IMAGE, filename);
+	}
+	data_reset();
+	dirty_reset();
+	if (read_meta(f, mapped, compressed) != EXIT_SUCCESS ||
+	    (!mapped && (read_files_extents(f) != EXIT_SUCCESS ||
+	                 (image_fd = dup(fileno(f))) < 0))) {
+		log_error(ERR_FS_FREAD, filename, strerror(errno));
 		fclose(f);
 		return FS_ERROR;
 	}
+	image_compressed = compressed;
+	image_dedup = header.flags & FS_IMAGE_DEDUP;
 	fclose(f);
-	printf(LOG_DESERIALIZE, filename);
+	if (mapped && open_blocks(filename) != EXIT_SUCCESS) {
+		return FS_ERROR;
+	}
+	if (journal_replay(filename, apply_record) != 0) {
+		log_error(ERR_JOURNAL_REPLAY, filename);
+		return FS_ERROR;
+	}
+	if (mapped && claim_files_blocks() != EXIT_SUCCESS) {
+		log_error(ERR_FS_CLAIM, filename, filename, BLOCKS_SUFFIX);
+		return FS_ERROR;
+	}
+	// What the journal wrote is shared like it was before the crash
+	dedup_dirty_all();
+	dirty_reset();
+	journal_open(filename);
+	if (fs_index_rebuild() != EXIT_SUCCESS) {
+		return FS_ERROR;
+	}
+	number_entries();
+	count_all_dirs();
+	log_info(LOG_DESERIALIZE, filename);
+	return EXIT_SUCCESS;
+}
+
+// load the filesystem from filename, creating a new one when it can't be
+// loaded
+void
+fs_mount(const char *filename)
+{
+	if (fs_deserialize(filename) != 0) {
+		log_info(LOG_NO_PERSIST);
+		if (fs_create(filename) != 0) {
+			log_error(ERR_SERIALIZE);
+		}
+	} else {
+		log_info(LOG_FS_LOADED);
+	}
+}
+
+// Remove count arguments starting at i, so that fuse doesn't use our
+// arguments or their values as the mount folder. Equivalent to a pop.
+static void
+pop_args(int *argc, char *argv[], int i, int count)
+{
+	for (int j = i; j + count <= *argc; j++) {
+		argv[j] = argv[j + count];
+	}
+	*argc -= count;
+}
+
+// Positive number given as the value of option, or 0 if it isn't one
+static long
+parse_positive(const char *option, const char *value)
+{
+	char *end;
+	long n = strtol(value, &end, 10);
+	if (*value == STRING_END || *end != STRING_END || n <= 0 || n > INT32_MAX) {
+		fprintf(stderr, ERR_WRITEBACK_ARG, value, option);
+		return 0;
+	}
+	return n;
+}
+
+// take the options of fisopfs out of argv, leaving the ones for fuse
+int
+fs_parse_args(int *argc, char *argv[], char **filedisk)
+{
+	bool wants_writeback = false;
+	long interval = WRITEBACK_INTERVAL;
+	long dirty = WRITEBACK_DIRTY;
+	int i = 1;
+	while (i < *argc) {
+		if (strcmp(argv[i], "--filedisk") == 0 && i + 1 < *argc) {
+			*filedisk = argv[i + 1];
+			pop_args(argc, argv, i, 2);
+		} else if (strcmp(argv[i], "--mmap") == 0) {
+			fs_set_mmap(true);
+			pop_args(argc, argv, i, 1);
+		} else if (strcmp(argv[i], "--compress") == 0) {
+			fs_set_compress(true);
+			pop_args(argc, argv, i, 1);
+		} else if (strcmp(argv[i], "--dedup") == 0) {
+			fs_set_dedup(true);
+			pop_args(argc, argv, i, 1);
+		} else if (strcmp(argv[i], "--bg-checkpoint") == 0) {
+			fs_set_background_checkpoint(true);
+			pop_args(argc, argv, i, 1);
+		} else if (strcmp(argv[i], "--writeback") == 0) {
+			wants_writeback = true;
+			pop_args(argc, argv, i, 1);
+		} else if (strcmp(argv[i], "--flush-interval") == 0 && i + 1 < *argc) {
+			interval = parse_positive(argv[i], argv[i + 1]);
+			if (interval == 0) {
+				return FS_ERROR;
+			}
+			wants_writeback = true;
+			pop_args(argc, argv, i, 2);
+		} else if (strcmp(argv[i], "--flush-dirty") == 0 && i + 1 < *argc) {
+			dirty = parse_positive(argv[i], argv[i + 1]);
+			if (dirty == 0) {
+				return FS_ERROR;
+			}
+			wants_writeback = true;
+			pop_args(argc, argv, i, 2);
+		} else if (strcmp(argv[i], "--log-level") == 0 && i + 1 < *argc) {
+			log_level = log_parse_level(argv[i + 1]);
+			if (log_level == LEVEL_BAD) {
+				fprintf(stderr, ERR_LOG_LEVEL, argv[i + 1]);
+				return FS_ERROR;
+			}
+			pop_args(argc, argv, i, 2);
+		} else {
+			i++;
+		}
+	}
+	if (wants_writeback) {
+		fs_set_writeback(interval, dirty);
+	}
 	return EXIT_SUCCESS;
-}
\ No newline at end of file
+}
@@ -3,16 +3,26 @@
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <sys/file.h>
+#include <fcntl.h>
+#include <sys/wait.h>
 #include <string.h>
 #include <stdlib.h>
 #include <errno.h>
 #include <fuse.h>
 #include <time.h>
 #include <stdbool.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <sys/uio.h>
+#include "blocks.h"
+#include "names.h"
+#include "journal.h"
+#include "lz.h"
+#include "stats.h"
+#include "log.h"
 
 #define SLASH '/' // Slash character for path separation
 #define SLASH_STR "/" // String representation of slash
-#define ROOT_PREV_PATH "" // Previous path for root directory
 #define STRING_END '\0'
 #define BINARY_WRITE "wb"
 #define BINARY_READ "rb"
@@ -20,109 +30,347 @@
 #define FS_ERROR -1 // Error code for file system operations
 #define BAD_INDEX -1 // Invalid index for inode lookup
 #define ROOT_INDEX 0
+#define ROOT_INO 1 // Inode number of the root, inode numbers are index + ROOT_INO
 #define NO_DATA_READ 0 // No data read from file
-#define NOT_USED_INODE 0 
-#define USED_INODE 1
 #define IS_ROOT 1 // Root user has all permissions
 #define MIN_FILE_NLINKS 1 // Minimum number of links for a file
 #define MIN_DIR_NLINKS 2 // Minimum number of links for a directory
 #define MAX_DEPTH 4 // Maximum depth of directories in the file system
 #define MAX_PATH_NAME 256 // Maximum length of a path name
-#define MAX_DATA 1024 // Maximum size of data in an inode
-#define MAX_INODES 256 // Maximum number of inodes in the file system
+#define MAX_FILE_SIZE ((off_t) 1 << 32) // Maximum size of a file
+#define ATIME_INTERVAL (24 * 60 * 60) // Seconds after which a read moves the access time anyway
+#define STAT_BLOCK_SIZE 512 // Unit of st_blocks
+#define FS_INLINE_MAX (FS_BLOCK_SIZE / 2) // Largest file kept inline instead of in blocks
+#define FS_INLINE_MIN 32 // Smallest buffer of an inline file
+#define FS_SEGMENTS(size) ((size) / FS_BLOCK_SIZE + 2) // Most segments fs_read_segments uses for size bytes
+#define INODE_CHUNK_BITS 10
+#define INODE_CHUNK (1 << INODE_CHUNK_BITS) // Inodes added each time the table grows
+#define MAX_INODE_CHUNKS 4096 // Chunks the inode table can grow to
+#define MAX_INODES (INODE_CHUNK * MAX_INODE_CHUNKS) // Maximum number of inodes in the file system
+#define STATS_INO (MAX_INODES + ROOT_INO) // Inode number of STATS_FILE, past every inode
+#define BITMAP_WORD_BITS 64 // Inodes tracked by each word of the bitmap
+#define BITMAP_CHUNK_WORDS (INODE_CHUNK / BITMAP_WORD_BITS) // Bitmap words per chunk
+#define BITMAP_FULL_WORD UINT64_MAX // Bitmap word with every inode in use
+#define INDEX_MIN_BUCKETS 512 // Buckets of an empty entry index (power of two)
+#define INDEX_PARENT_MIX 0x9E3779B1u // Multiplier mixing the parent index
+#define INDEX_NAME_MIX 0x85EBCA77u // Multiplier mixing the name id
+#define MAX_NAME_LEN 255 // Maximum length of a single path component
+#define FS_MAGIC 0x53465046 // "FPFS", identifies a persistence file
+#define FS_VERSION 9 // Version of the persistence file format
+#define FS_IMAGE_MAPPED 1 // Image flag: file data lives in the mapped blocks file
+#define FS_IMAGE_COMPRESSED 2 // Image flag: written a block at a time through the LZ codec
+#define FS_IMAGE_DEDUP 4 // Image flag: each block is tagged, blocks shared by files are stored once
+#define IMAGE_BLOCK_HERE 0 // Tag of a block whose bytes follow
+#define IMAGE_BLOCK_SHARED 1 // Tag of a shared block whose FS_BLOCK_SIZE bytes follow, other tags are where they are
+#define IMAGE_REFS_INITIAL 1024 // Initial slots of the table of shared blocks written to an image
+#define IMAGE_REFS_MULTIPLIER 0x9E3779B97F4A7C15ull // Fibonacci hashing of shared block keys
+#define FRAME_RAW 0x80000000u // Frame length flag: the block is stored as is
+#define TMP_SUFFIX ".tmp" // Appended to the image name while it is written
+#define BLOCKS_SUFFIX ".blocks" // Appended to the image name for the mapped blocks file
+#define DIRTY_META 1 // Inode metadata changed since the last flush
+#define DIRTY_DATA 2 // File contents changed since the last flush
+#define JOURNAL_OP_INODE 1 // Journal record with an inode and its name
+#define JOURNAL_OP_DATA 2 // Journal record with an inode, name and data
+#define JOURNAL_OP_FREE 3 // Journal record freeing an inode
+#define JOURNAL_OP_BLOCKS 4 // Journal record with an inode, name and block ids
+#define READ_LOCK false // Shared lock, for operations that only look
+#define WRITE_LOCK true // Exclusive lock, for operations that change things
+#define NO_HANDLE 0 // fi->fh of a file not opened through fisopfs_open
+#define NO_CHILD 0 // No background checkpoint being written
+#define HANDLE_GENERATION_SHIFT 32 // Bits of a handle below the generation
+#define DIR_COOKIE_DOTDOT 1 // Readdir offset resuming a listing at ".."
+#define DIR_COOKIE_CHILDREN 2 // Readdir offset resuming at the first entry
+#define DIR_COOKIE_BASE 3 // Added to the index of the entry an offset resumes at
+#define DIR_COOKIE_SEQ 0x7fffffff // Bits of the entry sequence number kept in an offset
+#define DIR_COOKIE_END INT64_MAX // Readdir offset past the last entry
+#ifndef RENAME_NOREPLACE
+#define RENAME_NOREPLACE (1 << 0) // fs_rename fails if the new name exists
+#define RENAME_EXCHANGE (1 << 1) // fs_rename swaps both entries
+#endif
+#define WRITEBACK_INTERVAL 5 // Seconds between flushes in write-back mode
+#define WRITEBACK_DIRTY 4096 // Dirty inodes that trigger a flush in write-back mode
 
 typedef enum {FILE_TYPE, DIR_TYPE} inode_type_t;
 
 // Inode struct
 typedef struct inode {
-    char name[MAX_PATH_NAME]; 
-	size_t size;
-	int uid;           
-	int gid;           
+	name_id_t name; // Interned name, NO_NAME for the root
+	int parent; // Index of the parent directory
+	int first_child; // First entry of a directory, BAD_INDEX if empty
+	int next_sibling; // Next entry in the parent directory
+	int prev_sibling; // Previous entry in the parent directory
 	inode_type_t type;
-    char path[MAX_PATH_NAME];
+	mode_t mode;
 	int nlink;
-	char prev_path[MAX_PATH_NAME];
-    char data[MAX_DATA];   
-    mode_t mode;       
-	time_t access_time; 
-	time_t modification_time;  
-	time_t creation_time; 
+	int uid;
+	int gid;
+	size_t size;
+	time_t access_time;
+	time_t modification_time;
+	time_t creation_time;
 } inode_t;
 
-// File system struct
+// File system struct. The inode table grows a chunk at a time, so inodes
+// never move once created.
 typedef struct filesystem_t {
-	struct inode inodes[MAX_INODES]; 
-	int inodes_bitmap[MAX_INODES];
+	inode_t *inode_chunks[MAX_INODE_CHUNKS];
+	uint64_t *inodes_bitmap; // One bit per inode, set if used
+	size_t inodes_capacity; // Inodes in the allocated chunks
 	size_t inodes_amount;
 } filesystem_t;
 
+// Blocks holding the contents of a file, kept only in memory. Blocks that
+// were never written (or were punched) are holes, NO_BLOCK, read as zeros.
+// Files of up to FS_INLINE_MAX bytes without blocks keep their contents
+// inline instead, in a buffer sized to them, and move to blocks once they
+// grow past that.
+typedef struct file_data {
+	block_id_t *blocks;
+	size_t blocks_amount;
+	size_t blocks_capacity;
+	size_t blocks_allocated; // Blocks that are not holes
+	char *inline_data; // Contents of an inline file, NULL if in blocks
+	size_t inline_capacity;
+} file_data_t;
+
+// Changes of an inode since the last flush
+typedef struct dirty_inode {
+	int flags;
+	off_t shrink_to; // Smallest size the file had since the last flush
+	off_t from; // Range of file data written since the last flush
+	off_t to;
+} dirty_inode_t;
+
+// Data part of a JOURNAL_OP_DATA record, followed by len bytes
+typedef struct journal_data {
+	uint64_t shrink_to;
+	uint64_t offset;
+	uint64_t len;
+} journal_data_t;
+
+// Header at the start of the persistence file
+typedef struct fs_image_header {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t flags;
+	uint32_t reserved;
+} fs_image_header_t;
+
+// What the child writing a background checkpoint reports to its parent
+typedef struct checkpoint_report {
+	uint64_t ns; // Time it took to write the image
+	uint64_t bytes; // Size of the image
+} checkpoint_report_t;
+
+// In-memory state of an inode, not persisted
+typedef struct inode_state {
+	int index_next; // Next inode in the same bucket of the entry index
+	file_data_t data; // Contents of the file
+	dirty_inode_t dirty; // Changes since the last flush
+	pthread_rwlock_t lock; // Guards the inode and its contents
+	uint64_t lookups; // Kernel references, a freed slot waits until they are forgotten
+	uint32_t generation; // Times the slot was freed, sent along with the inode number
+	uint32_t seq; // Order the entry was linked in its directory, higher for the newer
+	uint32_t next_seq; // Sequence number of the last entry linked in the directory
+	uint32_t dirs_below[MAX_DEPTH]; // Directories 1, 2... levels below the directory
+	off_t image_offset; // Where the contents not loaded yet are in the image, 0 once loaded
+	uint64_t image_len; // Bytes they take there
+} inode_state_t;
+
+// Header of the inode table in the persistence file, followed by the
+// bitmap and then only the used inodes
+typedef struct fs_table_header {
+	uint64_t capacity;
+	uint64_t amount;
+} fs_table_header_t;
+
+// Where the contents of a file are in the image, one per file after the
+// names. The contents are the number of each block that isn't a hole,
+// followed by the bytes of each of them.
+typedef struct fs_file_extent {
+	uint64_t offset;
+	uint64_t len;
+	uint64_t allocated; // Blocks that aren't holes
+} fs_file_extent_t;
+
+// Header of each block of a compressed image, followed by len bytes. The
+// metadata is cut in FS_BLOCK_SIZE blocks after its total length, file
+// contents keep their own blocks.
+typedef struct fs_image_frame {
+	uint32_t len; // Bytes stored, with FRAME_RAW if they didn't compress
+	uint32_t checksum; // FNV-1a of the block before compressing
+} fs_image_frame_t;
+
+// Called by fs_list_dir with each entry and the offset that resumes the
+// listing after it, returns nonzero to stop
+typedef int (*fs_dir_filler_t)(void *ctx, const char *name, int index, off_t next);
+
 extern filesystem_t fs;
 
+// Inode at index of the inode table
+static inline inode_t *
+fs_inode(int index)
+{
+	return &fs.inode_chunks[index >> INODE_CHUNK_BITS][index & (INODE_CHUNK - 1)];
+}
+
 // File system functions
-void fs_initialize();
+int fs_initialize();
+void fs_set_mmap(bool enabled);
+void fs_set_background_checkpoint(bool enabled);
+void fs_set_compress(bool enabled);
+void fs_set_dedup(bool enabled);
+void fs_set_writeback(int interval, size_t dirty);
+bool fs_writeback_enabled();
+int fs_writeback_start(const char *filename);
+void fs_writeback_stop();
+int fs_create(const char *filename);
 int fs_add_inode(inode_t *inode);
 int fs_create_entry(const char *path, mode_t mode, int type);
+int fs_create_child(int parent, const char *name, mode_t mode, int type);
 int fs_lookup(const char *path);
-void modify_nlink_path(const char *path, bool add);
+int fs_lookup_parent(const char *path, const char **name);
+int fs_lookup_child(int parent, const char *name);
+const char *fs_name(int index);
+size_t fs_free_inodes();
+bool fs_inode_used(int index);
+void fs_stat(int index, struct stat *st);
+void fs_statfs(struct statvfs *st);
+void fs_lookup_ref(int index);
+void fs_forget(int index, uint64_t nlookup);
+uint32_t fs_generation(int index);
+void fs_remove_entry(int index);
+int fs_rename(int index, int parent, const char *name, unsigned int flags);
+int fs_depth(int index);
+void fs_list_dir(int dir, off_t offset, fs_dir_filler_t fill, void *ctx);
+int fs_index_rebuild();
+void modify_nlink(int index, bool add);
 
-void extract_filename(const char *path, char *out);
-void extract_prev_path(const char *path, char *out);
-static int find_free_inode_slot(filesystem_t *fs);
+ssize_t fs_read_data(int index, char *buffer, size_t size, off_t offset);
+ssize_t fs_read_segments(int index, struct iovec *segments, int *count, size_t size, off_t offset);
+ssize_t fs_write_data(int index, const char *buffer, size_t size, off_t offset);
+ssize_t fs_write_bufvec(int index, struct fuse_bufvec *src, size_t size, off_t offset);
+int fs_truncate_data(int index, off_t size);
+int fs_fallocate_data(int index, int mode, off_t offset, off_t len);
+void fs_mark_dirty(int index, int flags);
+bool fs_mark_read(int index);
+void fs_lock_tree(bool write);
+void fs_unlock_tree();
+void fs_lock_inode(int index, bool write);
+void fs_unlock_inode(int index);
+int fs_lookup_lock(const char *path, bool write);
+int fs_index_lock(int index, bool write);
+uint64_t fs_handle(int index);
+int fs_handle_lock(uint64_t handle, bool write);
+void fs_unlock(int index);
+int fs_flush(const char *filename);
+int fs_sync(const char *filename);
+int fs_checkpoint(const char *filename);
 int fs_serialize(const char *filename);
 int fs_deserialize(const char *filename);
+void fs_mount(const char *filename);
+int fs_parse_args(int *argc, char *argv[], char **filedisk);
 
 // Constants for messages all around fisopfs and persistence file:
 // Persistence namefile:
 #define DEFAULT_FILE_DISK "persistence_file.fisopfs"
 
-// Debug messages:
-#define LOG_INIT_START "[debug] fisopfs_init - Starting init\n"
-#define LOG_NO_PERSIST "[debug] No persistence file found, initializing new FS\n"
-#define LOG_FS_LOADED "[debug] Filesystem loaded from disk\n"
-#define LOG_DESTROY "[debug] fisopfs_destroy - Saving FS data\n"
-#define LOG_FLUSH "[debug] fisopfs_flush - path: %s\n"
-#define LOG_GETATTR "[debug] fisopfs_getattr - path: %s\n"
-#define LOG_GETATTR_NOT_FOUND "[debug] fisopfs_getattr - path: \"%s\" not found\n"
-#define LOG_READDIR "[debug] fisopfs_readdir - path: %s\n"
-#define LOG_READDIR_FOUND "[debug] fisopfs_readdir - found: %s\n"
-#define LOG_READ "[debug] fisopfs_read - path: %s, offset: %lu, size: %lu\n"
-#define LOG_MKDIR "[debug] fisopfs_mkdir - path: %s - mode: %d\n"
-#define LOG_CREATE "[debug] fisopfs_create - path: %s - mode: %d\n"
-#define LOG_RMDIR "[debug] fisopfs_rmdir - path: %s\n"
-#define LOG_WRITE "[debug] fisopfs_write - path: %s - buffer: %s - size: %zu - offset: %ld\n"
-#define LOG_TRUNCATE "[debug] fisopfs_truncate - path: %s - size: %ld\n"
-#define LOG_UNLINK "[debug] fisopfs_unlink - path: %s"
-#define LOG_UTIMENS "[debug] fisopfs_ultimens - path: %s"
-#define LOG_ENTRY "[debug] fs_create_entry: path=%s mode=%d type=%d\n"
-#define LOG_INIT "[debug] fs_initialize: setting up root directory\n"
-#define LOG_SERIALIZE "[debug] fs_serialize - File system saved to '%s'\n"
-#define LOG_DESERIALIZE "[debug] fs_deserialize - File system loaded from '%s'\n"
-#define LOG_CHOWN "[debug] fisopfs_chown - path: %s, uid: %d, gid: %d\n"
-#define LOG_CHMOD "[debug] fisopfs_chmod - path: %s, mode: %o\n"
+// Info and debug messages:
+#define LOG_INIT_START "fisopfs_init - Starting init\n"
+#define LOG_NO_PERSIST "No persistence file found, initializing new FS\n"
+#define LOG_FS_LOADED "Filesystem loaded from disk\n"
+#define LOG_DESTROY "fisopfs_destroy - Saving FS data\n"
+#define LOG_FLUSH "fisopfs_flush - path: %s\n"
+#define LOG_FSYNC "fisopfs_fsync - path: %s\n"
+#define LOG_GETATTR "fisopfs_getattr - path: %s\n"
+#define LOG_GETATTR_NOT_FOUND "fisopfs_getattr - path: \"%s\" not found\n"
+#define LOG_READDIR "fisopfs_readdir - path: %s\n"
+#define LOG_READDIR_FOUND "fisopfs_readdir - found: %s\n"
+#define LOG_READ "fisopfs_read - path: %s, offset: %ld, size: %zu\n"
+#define LOG_MKDIR "fisopfs_mkdir - path: %s - mode: %d\n"
+#define LOG_CREATE "fisopfs_create - path: %s - mode: %d\n"
+#define LOG_RMDIR "fisopfs_rmdir - path: %s\n"
+#define LOG_WRITE "fisopfs_write - path: %s - size: %zu - offset: %ld\n"
+#define LOG_TRUNCATE "fisopfs_truncate - path: %s - size: %ld\n"
+#define LOG_RENAME "fisopfs_rename - from: %s - to: %s\n"
+#define LOG_UNLINK "fisopfs_unlink - path: %s\n"
+#define LOG_UTIMENS "fisopfs_utimens - path: %s\n"
+#define LOG_ENTRY "fs_create_entry: path=%s mode=%d type=%d\n"
+#define LOG_INIT "fs_initialize: setting up root directory\n"
+#define LOG_SERIALIZE "fs_serialize - File system saved to '%s'\n"
+#define LOG_DESERIALIZE "fs_deserialize - File system loaded from '%s'\n"
+#define LOG_JOURNAL_FLUSH "fs_flush - %zu inodes journaled, journal size %zu\n"
+#define LOG_MMAP_IGNORED "fs_deserialize - '%s' keeps file data in the image, --mmap ignored\n"
+#define LOG_COMPRESSED_IMAGE "fs_deserialize - '%s' is compressed\n"
+#define LOG_DEDUP_IGNORED "fs_deserialize - '%s' keeps file data in the blocks file, --dedup ignored\n"
+#define LOG_MMAP_IMAGE "fs_deserialize - '%s' keeps file data in '%s%s', using mmap\n"
+#define LOG_CHECKPOINT "fs_checkpoint - image '%s' rewritten, journal emptied\n"
+#define LOG_BG_CHECKPOINT_START "fs_flush - writing image '%s' from child %jd\n"
+#define LOG_BG_CHECKPOINT "fs_flush - image '%s' written in the background, %jd bytes in %.3f s\n"
+#define LOG_WRITEBACK_START "fs_writeback - flushing every %d s or at %zu dirty inodes\n"
+#define LOG_CHOWN "fisopfs_chown - path: %s, uid: %d, gid: %d\n"
+#define LOG_CHMOD "fisopfs_chmod - path: %s, mode: %o\n"
+#define LOG_STATFS "fisopfs_statfs - path: %s\n"
+#define LOG_OPEN "fisopfs_open - path: %s\n"
+#define LOG_FALLOCATE "fisopfs_fallocate - path: %s - mode: %#x - offset: %ld - len: %ld\n"
+#define LOG_FTRUNCATE "fisopfs_ftruncate - path: %s - size: %ld\n"
+#define LOG_LL_LOOKUP "fisopfs_ll_lookup - parent: %lu, name: %s\n"
+#define LOG_LL_FORGET "fisopfs_ll_forget - ino: %lu, nlookup: %lu\n"
+#define LOG_LL_GETATTR "fisopfs_ll_getattr - ino: %lu\n"
+#define LOG_LL_SETATTR "fisopfs_ll_setattr - ino: %lu, to_set: %#x\n"
+#define LOG_LL_READDIR "fisopfs_ll_readdir - ino: %lu, offset: %ld\n"
+#define LOG_LL_MKDIR "fisopfs_ll_mkdir - parent: %lu, name: %s, mode: %o\n"
+#define LOG_LL_CREATE "fisopfs_ll_create - parent: %lu, name: %s, mode: %o\n"
+#define LOG_LL_UNLINK "fisopfs_ll_unlink - parent: %lu, name: %s\n"
+#define LOG_LL_RENAME "fisopfs_ll_rename - parent: %lu, name: %s, newparent: %lu, newname: %s\n"
+#define LOG_LL_RMDIR "fisopfs_ll_rmdir - parent: %lu, name: %s\n"
+#define LOG_LL_OPEN "fisopfs_ll_open - ino: %lu\n"
+#define LOG_LL_READ "fisopfs_ll_read - ino: %lu, offset: %ld, size: %zu\n"
+#define LOG_LL_WRITE "fisopfs_ll_write - ino: %lu, size: %zu, offset: %ld\n"
+#define LOG_LL_FALLOCATE "fisopfs_ll_fallocate - ino: %lu, mode: %#x, offset: %ld, len: %ld\n"
+#define LOG_LL_FLUSH "fisopfs_ll_flush - ino: %lu\n"
+#define LOG_LL_FSYNC "fisopfs_ll_fsync - ino: %lu\n"
 
 // Error messages:
-#define ERR_SERIALIZE "[debug] Error fisopfs_destroy: Failed to save FS during destroy\n"
-#define ERR_FLUSH "[debug] Error fisopfs_flush: Failed to save FS during flush\n"
-#define ERR_NOT_DIR "[debug] Error readdir: Not a directory\n"
-#define ERR_READ_NOT_FOUND "[debug] fisopfs_read - path: \"%s\" not found\n"
-#define ERR_DEPTH "[debug] Error mkdir: max directory depth exceeded\n"
-#define ERR_NOT_DIR_RMDIR "[debug] Error rmdir: Not a directory\n"
-#define ERR_NOT_EMPTY "[debug] Error rmdir: Directory not empty\n"
-#define ERR_RM_ROOT "[debug] Error rmdir: Cannot remove root directory\n"
-#define ERR_RM_NOT_FOUND "[debug] fisopfs_rmdir - path: \"%s\" not found\n"
-#define ERR_WRITE_TYPE "[debug] Error write: Not a file\n"
-#define ERR_WRITE_SPACE "[debug] Error write: not enough space \n"
-#define ERR_WRITE_PERM "[debug] Error write: Permission denied\n"
-#define ERR_WRITE_NOT_FOUND "[debug] fisopfs_write - path: \"%s\" not found\n"
-#define ERR_TRUNC_SIZE "[debug] Error truncate: size exceeded"
-#define ERR_TRUNC_NOT_FOUND "[debug] fisopfs_truncate - path: \"%s\" not found\n"
-#define ERR_TRUNC_TYPE "[debug] Error truncate: Not a file\n"
-#define ERR_TRUNC_PERM "[debug] Error truncate: Permission denied\n"
-#define ERR_UNLINK_TYPE "[debug] Error unlink: Not a file\n"
-#define ERR_UNLINK_PERM "[debug] Error unlink: Permission denied\n"
-#define ERR_UTIMENS_TYPE "[debug] Error ultimens: Not a file\n"
-#define ERR_CREATE_INODE "[debug] Error create: Can`t create more inodes"
-#define ERR_FS_FOPEN "[debug] fs_serialize - fopen '%s': "
-#define ERR_FS_FWRITE "[debug] fs_serialize - fwrite '%s': "
-#define ERR_FS_FREAD "[debug] fs_deserialize - fread '%s': "
\ No newline at end of file
+#define ERR_SERIALIZE "Error fisopfs_destroy: Failed to save FS during destroy\n"
+#define ERR_FLUSH "Error fisopfs_flush: Failed to save FS during flush\n"
+#define ERR_FSYNC "Error fisopfs_fsync: Failed to save FS during fsync\n"
+#define ERR_WRITEBACK_START "Error fisopfs_init: Can't start the flusher thread, flushing on close\n"
+#define ERR_NOT_DIR "Error readdir: Not a directory\n"
+#define ERR_READ_NOT_FOUND "fisopfs_read - path: \"%s\" not found\n"
+#define ERR_DEPTH "Error mkdir: max directory depth exceeded\n"
+#define ERR_NOT_DIR_RMDIR "Error rmdir: Not a directory\n"
+#define ERR_NOT_EMPTY "Error rmdir: Directory not empty\n"
+#define ERR_RM_ROOT "Error rmdir: Cannot remove root directory\n"
+#define ERR_RM_NOT_FOUND "fisopfs_rmdir - path: \"%s\" not found\n"
+#define ERR_WRITE_TYPE "Error write: Not a file\n"
+#define ERR_WRITE_SPACE "Error write: not enough space \n"
+#define ERR_WRITE_SIZE "Error write: file too large\n"
+#define ERR_WRITE_PERM "Error write: Permission denied\n"
+#define ERR_WRITE_NOT_FOUND "fisopfs_write - path: \"%s\" not found\n"
+#define ERR_TRUNC_SIZE "Error truncate: size exceeded\n"
+#define ERR_TRUNC_SPACE "Error truncate: not enough space\n"
+#define ERR_TRUNC_NOT_FOUND "fisopfs_truncate - path: \"%s\" not found\n"
+#define ERR_TRUNC_TYPE "Error truncate: Not a file\n"
+#define ERR_TRUNC_PERM "Error truncate: Permission denied\n"
+#define ERR_UNLINK_TYPE "Error unlink: Not a file\n"
+#define ERR_UNLINK_PERM "Error unlink: Permission denied\n"
+#define ERR_UTIMENS_TYPE "Error ultimens: Not a file\n"
+#define ERR_CREATE_INODE "Error create: Can`t create more inodes\n"
+#define ERR_CREATE_NAME "Error create: Name too long\n"
+#define ERR_FS_FOPEN "fs_serialize - fopen '%s': %s\n"
+#define ERR_FS_FWRITE "fs_serialize - fwrite '%s': %s\n"
+#define ERR_FS_FREAD "fs_deserialize - fread '%s': %s\n"
+#define ERR_FS_BLOCKS "fs_blocks - failed to map '%s%s': %s\n"
+#define ERR_FS_LOAD "fs_load - can't read the contents of inode %d from the image\n"
+#define ERR_FS_RENAME "fs_serialize - rename '%s': %s\n"
+#define ERR_JOURNAL "fs_flush - journal of '%s' failed, writing a checkpoint\n"
+#define ERR_BG_CHECKPOINT "fs_flush - background checkpoint of '%s' failed, its journal is kept\n"
+#define ERR_FORK "fs_flush - can't fork to write '%s': %s, writing a checkpoint\n"
+#define ERR_PIPE "fs_flush - can't open a pipe to the child writing '%s': %s, writing a checkpoint\n"
+#define ERR_JOURNAL_REPLAY "fs_deserialize - failed to replay journal of '%s'\n"
+#define ERR_WRITEBACK "fs_writeback - flush of '%s' failed, retrying in the next interval\n"
+#define ERR_WRITEBACK_ARG "Invalid value '%s' for %s, use a positive number\n"
+#define ERR_LOG_LEVEL "Unknown log level '%s', use error, info or debug\n"
+#define ERR_FS_CLAIM "fs_deserialize - '%s' uses blocks missing from '%s%s'\n"
+#define ERR_FS_FORMAT "fs_deserialize - '%s' is not a fisopfs v%d image\n"
\ No newline at end of file
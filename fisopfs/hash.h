@@ -0,0 +1,33 @@
+#ifndef HASH_H_
+#define HASH_H_
+#include <stddef.h>
+#include <stdint.h>
+
+#define FNV_OFFSET_BASIS 2166136261u // FNV-1a 32 bits initial hash value
+#define FNV_PRIME 16777619u // FNV-1a 32 bits multiplier
+
+// Continue an FNV-1a hash over len bytes of buf
+static inline uint32_t
+fnv1a_update(uint32_t hash, const void *buf, size_t len)
+{
+	const unsigned char *p = buf;
+	for (size_t i = 0; i < len; i++) {
+		hash ^= p[i];
+		hash *= FNV_PRIME;
+	}
+	return hash;
+}
+
+// FNV-1a hash of a NUL terminated string
+static inline uint32_t
+fnv1a_str(const char *str)
+{
+	uint32_t hash = FNV_OFFSET_BASIS;
+	for (const char *p = str; *p != '\0'; p++) {
+		hash ^= (unsigned char) *p;
+		hash *= FNV_PRIME;
+	}
+	return hash;
+}
+
+#endif  // HASH_H_
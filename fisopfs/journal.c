@@ -0,0 +1,272 @@
+#define _GNU_SOURCE
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "journal.h"
+#include "hash.h"
+
+static FILE *journal;
+static size_t journal_bytes;
+
+// Checksum and bytes left of the record being appended
+static uint32_t record_checksum;
+static uint64_t record_remaining;
+
+// Build the journal path for the given image
+static int
+journal_path(const char *image, char *out)
+{
+	int len = snprintf(out, JOURNAL_PATH_MAX, "%s%s", image, JOURNAL_SUFFIX);
+	return (len < 0 || len >= JOURNAL_PATH_MAX) ? JOURNAL_ERROR : 0;
+}
+
+// Build the path of the journal of image set aside by journal_rotate
+static int
+journal_old_path(const char *image, char *out)
+{
+	int len = snprintf(out,
+	                   JOURNAL_PATH_MAX,
+	                   "%s%s%s",
+	                   image,
+	                   JOURNAL_SUFFIX,
+	                   JOURNAL_OLD_SUFFIX);
+	return (len < 0 || len >= JOURNAL_PATH_MAX) ? JOURNAL_ERROR : 0;
+}
+
+// Open the journal of image for appending, creating it if needed
+int
+journal_open(const char *image)
+{
+	char path[JOURNAL_PATH_MAX];
+	if (journal_path(image, path) != 0) {
+		return JOURNAL_ERROR;
+	}
+	journal_close();
+	journal = fopen(path, "ab");
+	if (journal == NULL) {
+		return JOURNAL_ERROR;
+	}
+	fseek(journal, 0, SEEK_END);
+	journal_bytes = ftell(journal);
+	return 0;
+}
+
+// Close the journal, if open
+void
+journal_close()
+{
+	if (journal != NULL) {
+		fclose(journal);
+		journal = NULL;
+	}
+}
+
+// Start a record whose payload is written with journal_write
+int
+journal_begin(uint32_t op, int32_t index, uint64_t payload_len)
+{
+	if (journal == NULL) {
+		return JOURNAL_ERROR;
+	}
+	journal_header_t header = { .magic = JOURNAL_MAGIC,
+		                    .op = op,
+		                    .index = index,
+		                    .payload_len = payload_len };
+	record_checksum =
+	        fnv1a_update(FNV_OFFSET_BASIS, &header, sizeof(header));
+	record_remaining = payload_len;
+	if (fwrite(&header, sizeof(header), 1, journal) != 1) {
+		return JOURNAL_ERROR;
+	}
+	journal_bytes += sizeof(header);
+	return 0;
+}
+
+// Append part of the payload of the current record
+int
+journal_write(const void *buf, size_t len)
+{
+	if (len == 0) {
+		return 0;
+	}
+	if (len > record_remaining || fwrite(buf, len, 1, journal) != 1) {
+		return JOURNAL_ERROR;
+	}
+	record_checksum = fnv1a_update(record_checksum, buf, len);
+	record_remaining -= len;
+	journal_bytes += len;
+	return 0;
+}
+
+// Finish the current record by appending its checksum
+int
+journal_end()
+{
+	if (record_remaining != 0 ||
+	    fwrite(&record_checksum, sizeof(record_checksum), 1, journal) != 1) {
+		return JOURNAL_ERROR;
+	}
+	journal_bytes += sizeof(record_checksum);
+	return 0;
+}
+
+// Close the group of records appended so far and push it to the file
+int
+journal_commit()
+{
+	if (journal_begin(JOURNAL_OP_COMMIT, JOURNAL_NO_INDEX, 0) != 0 ||
+	    journal_end() != 0 || fflush(journal) != 0) {
+		return JOURNAL_ERROR;
+	}
+	return 0;
+}
+
+// Push the committed records all the way to the disk
+int
+journal_sync()
+{
+	if (journal == NULL || fflush(journal) != 0 || fsync(fileno(journal)) != 0) {
+		return JOURNAL_ERROR;
+	}
+	return 0;
+}
+
+// Bytes currently in the journal
+size_t
+journal_size()
+{
+	return journal_bytes;
+}
+
+// Empty the journal, once its records are part of the image
+int
+journal_reset()
+{
+	if (journal == NULL || fflush(journal) != 0 ||
+	    ftruncate(fileno(journal), 0) != 0) {
+		return JOURNAL_ERROR;
+	}
+	journal_bytes = 0;
+	return 0;
+}
+
+// Set the journal of image aside and start an empty one, so an image
+// being written elsewhere can include the old records only. There must be
+// no journal set aside already.
+int
+journal_rotate(const char *image)
+{
+	char path[JOURNAL_PATH_MAX], old[JOURNAL_PATH_MAX];
+	if (journal == NULL || journal_path(image, path) != 0 ||
+	    journal_old_path(image, old) != 0 || fflush(journal) != 0 ||
+	    rename(path, old) != 0) {
+		return JOURNAL_ERROR;
+	}
+	return journal_open(image);
+}
+
+// Drop the journal set aside, once an image holding its records is saved
+int
+journal_remove_old(const char *image)
+{
+	char old[JOURNAL_PATH_MAX];
+	if (journal_old_path(image, old) != 0 ||
+	    (unlink(old) != 0 && errno != ENOENT)) {
+		return JOURNAL_ERROR;
+	}
+	return 0;
+}
+
+// Whether there is a journal of image set aside
+int
+journal_has_old(const char *image)
+{
+	char old[JOURNAL_PATH_MAX];
+	return journal_old_path(image, old) == 0 && access(old, F_OK) == 0;
+}
+
+// Length of the valid record starting at pos, 0 if torn or corrupt
+static size_t
+record_length(const char *buf, size_t size, size_t pos)
+{
+	journal_header_t header;
+	uint32_t checksum;
+	if (size - pos < sizeof(header) + sizeof(checksum)) {
+		return 0;
+	}
+	memcpy(&header, buf + pos, sizeof(header));
+	if (header.magic != JOURNAL_MAGIC ||
+	    header.payload_len > size - pos - sizeof(header) - sizeof(checksum)) {
+		return 0;
+	}
+	size_t len = sizeof(header) + header.payload_len;
+	memcpy(&checksum, buf + pos + len, sizeof(checksum));
+	if (checksum != fnv1a_update(FNV_OFFSET_BASIS, buf + pos, len)) {
+		return 0;
+	}
+	return len + sizeof(checksum);
+}
+
+// Apply every committed record of the journal at path, dropping any torn
+// or uncommitted tail left by a crash
+static int
+replay_file(const char *path, journal_apply_t apply)
+{
+	FILE *f = fopen(path, "r+b");
+	if (f == NULL) {
+		return 0;
+	}
+	fseek(f, 0, SEEK_END);
+	size_t size = ftell(f);
+	rewind(f);
+	char *buf = malloc(size ? size : 1);
+	if (buf == NULL || fread(buf, 1, size, f) != size) {
+		free(buf);
+		fclose(f);
+		return JOURNAL_ERROR;
+	}
+	size_t committed = 0;
+	size_t len;
+	for (size_t pos = 0; (len = record_length(buf, size, pos)) > 0;
+	     pos += len) {
+		journal_header_t header;
+		memcpy(&header, buf + pos, sizeof(header));
+		if (header.op == JOURNAL_OP_COMMIT) {
+			committed = pos + len;
+		}
+	}
+	int res = 0;
+	for (size_t pos = 0; pos < committed && res == 0; pos += len) {
+		len = record_length(buf, size, pos);
+		journal_header_t header;
+		memcpy(&header, buf + pos, sizeof(header));
+		if (header.op != JOURNAL_OP_COMMIT) {
+			res = apply(header.op,
+			            header.index,
+			            buf + pos + sizeof(header),
+			            header.payload_len);
+		}
+	}
+	if (res == 0 && committed < size && ftruncate(fileno(f), committed) != 0) {
+		res = JOURNAL_ERROR;
+	}
+	free(buf);
+	fclose(f);
+	return res;
+}
+
+// Apply the journal of image, after the one set aside if a background
+// checkpoint didn't finish. Records already in the image are applied
+// again, which leaves the inodes as they were.
+int
+journal_replay(const char *image, journal_apply_t apply)
+{
+	char path[JOURNAL_PATH_MAX], old[JOURNAL_PATH_MAX];
+	if (journal_path(image, path) != 0 || journal_old_path(image, old) != 0 ||
+	    replay_file(old, apply) != 0) {
+		return JOURNAL_ERROR;
+	}
+	return replay_file(path, apply);
+}
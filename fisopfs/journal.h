@@ -0,0 +1,46 @@
+#ifndef JOURNAL_H_
+#define JOURNAL_H_
+#include <stddef.h>
+#include <stdint.h>
+
+#define JOURNAL_SUFFIX ".journal" // Appended to the image name
+#define JOURNAL_OLD_SUFFIX ".old" // Appended to a journal set aside by journal_rotate
+#define JOURNAL_MAGIC 0x4C4E524A // "JRNL", starts every record
+#define JOURNAL_OP_COMMIT 0 // Record closing a group of records
+#define JOURNAL_NO_INDEX -1 // Index of records not tied to an inode
+#define JOURNAL_CHECKPOINT_SIZE (4 << 20) // Size that triggers a checkpoint
+#define JOURNAL_PATH_MAX 4096 // Maximum length of the journal path
+#define JOURNAL_ERROR -1
+
+// Header of a journal record, followed by payload_len bytes of payload
+// and the checksum of both
+typedef struct journal_header {
+	uint32_t magic;
+	uint32_t op;
+	int32_t index;
+	uint32_t reserved;
+	uint64_t payload_len;
+} journal_header_t;
+
+// Applies a committed record while replaying, returns 0 on success
+typedef int (*journal_apply_t)(uint32_t op,
+                               int32_t index,
+                               const char *payload,
+                               uint64_t payload_len);
+
+// Journal functions
+int journal_open(const char *image);
+void journal_close();
+int journal_begin(uint32_t op, int32_t index, uint64_t payload_len);
+int journal_write(const void *buf, size_t len);
+int journal_end();
+int journal_commit();
+int journal_sync();
+size_t journal_size();
+int journal_reset();
+int journal_rotate(const char *image);
+int journal_remove_old(const char *image);
+int journal_has_old(const char *image);
+int journal_replay(const char *image, journal_apply_t apply);
+
+#endif  // JOURNAL_H_
@@ -0,0 +1,71 @@
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include "log.h"
+
+int log_level = LEVEL_DEFAULT;
+
+static const char *level_names[] = { "error", "info", "debug" };
+
+// Errors printed in the current period, and those left out
+static pthread_mutex_t errors_lock = PTHREAD_MUTEX_INITIALIZER;
+static time_t errors_period;
+static unsigned int errors_printed;
+static unsigned int errors_suppressed;
+
+// Level for a name given to --log-level, LEVEL_BAD if unknown
+int
+log_parse_level(const char *name)
+{
+	for (int level = LEVEL_ERROR; level <= LEVEL_DEBUG; level++) {
+		if (strcmp(name, level_names[level]) == 0) {
+			return level;
+		}
+	}
+	return LEVEL_BAD;
+}
+
+// Whether another error fits in the current period. A failing operation
+// called in a loop would otherwise flood stderr.
+static bool
+error_allowed()
+{
+	pthread_mutex_lock(&errors_lock);
+	time_t now = time(NULL);
+	if (now - errors_period >= LOG_ERROR_PERIOD) {
+		if (errors_suppressed > 0) {
+			fprintf(stderr, "[error] " LOG_ERRORS_SUPPRESSED, errors_suppressed);
+		}
+		errors_period = now;
+		errors_printed = 0;
+		errors_suppressed = 0;
+	}
+	bool allowed = errors_printed < LOG_ERROR_BURST;
+	if (allowed) {
+		errors_printed++;
+	} else {
+		errors_suppressed++;
+	}
+	pthread_mutex_unlock(&errors_lock);
+	return allowed;
+}
+
+// Print a message, errors to stderr and the rest to stdout
+void
+log_print(int level, const char *format, ...)
+{
+	if (level == LEVEL_ERROR && !error_allowed()) {
+		return;
+	}
+	FILE *out = level == LEVEL_ERROR ? stderr : stdout;
+	va_list args;
+	va_start(args, format);
+	flockfile(out);
+	fprintf(out, "[%s] ", level_names[level]);
+	vfprintf(out, format, args);
+	funlockfile(out);
+	va_end(args);
+}
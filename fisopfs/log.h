@@ -0,0 +1,46 @@
+#ifndef LOG_H_
+#define LOG_H_
+#include <stdbool.h>
+
+#ifndef FS_DEBUG
+#define FS_DEBUG 1 // 0 compiles info and debug messages out (make release)
+#endif
+
+#define LEVEL_ERROR 0 // Only errors, rate limited
+#define LEVEL_INFO 1 // Also mounting, loading and saving the filesystem
+#define LEVEL_DEBUG 2 // Also every operation
+#define LEVEL_DEFAULT LEVEL_INFO
+#define LEVEL_BAD -1 // Returned for an unknown level name
+#define LOG_ERROR_BURST 20 // Errors printed per period, the rest are counted
+#define LOG_ERROR_PERIOD 1 // Length of a rate limiting period, in seconds
+#define LOG_ERRORS_SUPPRESSED "%u error messages suppressed\n"
+
+// Messages above this level are not printed, set from --log-level
+extern int log_level;
+
+int log_parse_level(const char *name);
+void log_print(int level, const char *format, ...)
+        __attribute__((format(printf, 2, 3)));
+
+// Debug and info messages cost a comparison when disabled at runtime, and
+// nothing in release builds: the call is still type checked but never
+// evaluated, so its arguments are not computed either.
+#if FS_DEBUG
+#define log_at(level, ...)                                                     \
+	do {                                                                   \
+		if (log_level >= (level))                                      \
+			log_print((level), __VA_ARGS__);                       \
+	} while (0)
+#else
+#define log_at(level, ...)                                                     \
+	do {                                                                   \
+		if (0)                                                         \
+			log_print((level), __VA_ARGS__);                       \
+	} while (0)
+#endif
+
+#define log_debug(...) log_at(LEVEL_DEBUG, __VA_ARGS__)
+#define log_info(...) log_at(LEVEL_INFO, __VA_ARGS__)
+#define log_error(...) log_print(LEVEL_ERROR, __VA_ARGS__)
+
+#endif  // LOG_H_
@@ -0,0 +1,173 @@
+#include <stdbool.h>
+#include <stdint.h>
+#include <string.h>
+#include "lz.h"
+
+#define LZ_HASH_MIX 2654435761u // Multiplier spreading 4 bytes over the table
+
+// Slot of the match table for the 4 bytes at p
+static uint32_t
+lz_hash(const unsigned char *p)
+{
+	uint32_t v;
+	memcpy(&v, p, sizeof(v));
+	return (v * LZ_HASH_MIX) >> (32 - LZ_HASH_BITS);
+}
+
+// Write the part of a length that doesn't fit in its token nibble, false
+// if it doesn't fit before end
+static bool
+put_len(unsigned char **out, const unsigned char *end, size_t len)
+{
+	for (; len >= LZ_LEN_MORE; len -= LZ_LEN_MORE) {
+		if (*out >= end) {
+			return false;
+		}
+		*(*out)++ = LZ_LEN_MORE;
+	}
+	if (*out >= end) {
+		return false;
+	}
+	*(*out)++ = len;
+	return true;
+}
+
+// Write a sequence: the token, the literals, and the match if match_len
+// isn't 0. False if it doesn't fit before end.
+static bool
+put_sequence(unsigned char **out,
+             const unsigned char *end,
+             const unsigned char *literals,
+             size_t literals_len,
+             size_t offset,
+             size_t match_len)
+{
+	size_t extra = match_len > 0 ? match_len - LZ_MIN_MATCH : 0;
+	if (*out >= end) {
+		return false;
+	}
+	*(*out)++ = (literals_len < LZ_LEN_MASK ? literals_len : LZ_LEN_MASK) << 4 |
+	            (extra < LZ_LEN_MASK ? extra : LZ_LEN_MASK);
+	if (literals_len >= LZ_LEN_MASK &&
+	    !put_len(out, end, literals_len - LZ_LEN_MASK)) {
+		return false;
+	}
+	if ((size_t) (end - *out) < literals_len) {
+		return false;
+	}
+	memcpy(*out, literals, literals_len);
+	*out += literals_len;
+	if (match_len == 0) {
+		return true;
+	}
+	if (end - *out < 2) {
+		return false;
+	}
+	*(*out)++ = offset & 0xFF;
+	*(*out)++ = offset >> 8;
+	return extra < LZ_LEN_MASK || put_len(out, end, extra - LZ_LEN_MASK);
+}
+
+// Compress the len bytes at src (at most LZ_MAX_INPUT) into dst. Returns
+// the compressed size, or 0 if it doesn't fit in cap bytes.
+size_t
+lz_compress(const char *src, size_t len, char *dst, size_t cap)
+{
+	const unsigned char *in = (const unsigned char *) src;
+	unsigned char *out = (unsigned char *) dst;
+	const unsigned char *end = out + cap;
+	// Position + 1 of the last 4 bytes seen with each hash, 0 if none
+	uint16_t table[1 << LZ_HASH_BITS];
+	if (len > LZ_MAX_INPUT) {
+		return 0;
+	}
+	memset(table, 0, sizeof(table));
+	size_t anchor = 0;
+	size_t i = 0;
+	while (i + LZ_MIN_MATCH <= len) {
+		uint32_t h = lz_hash(in + i);
+		size_t candidate = table[h];
+		table[h] = i + 1;
+		if (candidate == 0 || memcmp(in + candidate - 1, in + i, LZ_MIN_MATCH) != 0) {
+			i++;
+			continue;
+		}
+		candidate--;
+		size_t match_len = LZ_MIN_MATCH;
+		while (i + match_len < len && in[candidate + match_len] == in[i + match_len]) {
+			match_len++;
+		}
+		if (!put_sequence(&out, end, in + anchor, i - anchor, i - candidate, match_len)) {
+			return 0;
+		}
+		i += match_len;
+		anchor = i;
+	}
+	if (!put_sequence(&out, end, in + anchor, len - anchor, 0, 0)) {
+		return 0;
+	}
+	return out - (unsigned char *) dst;
+}
+
+// Read the part of a length past its token nibble, false if the input
+// ends first
+static bool
+get_len(const unsigned char **in, const unsigned char *end, size_t *len)
+{
+	unsigned char byte;
+	do {
+		if (*in >= end) {
+			return false;
+		}
+		byte = *(*in)++;
+		*len += byte;
+	} while (byte == LZ_LEN_MORE);
+	return true;
+}
+
+// Decompress the len bytes at src into dst. Returns the decompressed size,
+// or 0 if src is malformed or needs more than cap bytes.
+size_t
+lz_decompress(const char *src, size_t len, char *dst, size_t cap)
+{
+	const unsigned char *in = (const unsigned char *) src;
+	const unsigned char *in_end = in + len;
+	unsigned char *out = (unsigned char *) dst;
+	unsigned char *out_end = out + cap;
+	while (in < in_end) {
+		unsigned char token = *in++;
+		size_t literals_len = token >> 4;
+		if (literals_len == LZ_LEN_MASK && !get_len(&in, in_end, &literals_len)) {
+			return 0;
+		}
+		if ((size_t) (in_end - in) < literals_len ||
+		    (size_t) (out_end - out) < literals_len) {
+			return 0;
+		}
+		memcpy(out, in, literals_len);
+		in += literals_len;
+		out += literals_len;
+		if (in == in_end) {
+			break;
+		}
+		if (in_end - in < 2) {
+			return 0;
+		}
+		size_t offset = in[0] | in[1] << 8;
+		in += 2;
+		size_t match_len = token & LZ_LEN_MASK;
+		if (match_len == LZ_LEN_MASK && !get_len(&in, in_end, &match_len)) {
+			return 0;
+		}
+		match_len += LZ_MIN_MATCH;
+		if (offset == 0 || offset > (size_t) (out - (unsigned char *) dst) ||
+		    (size_t) (out_end - out) < match_len) {
+			return 0;
+		}
+		// Byte by byte, the match may overlap what it writes
+		for (size_t k = 0; k < match_len; k++, out++) {
+			*out = *(out - offset);
+		}
+	}
+	return out - (unsigned char *) dst;
+}
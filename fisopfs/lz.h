@@ -0,0 +1,17 @@
+#ifndef LZ_H_
+#define LZ_H_
+#include <stddef.h>
+
+#define LZ_MIN_MATCH 4 // Shortest match worth encoding
+#define LZ_MAX_INPUT 65535 // Largest input of lz_compress, offsets take 16 bits
+#define LZ_HASH_BITS 12 // Entries of the match table, as a power of two
+#define LZ_LEN_MASK 15 // Length in a token nibble, 15 continues in the next bytes
+#define LZ_LEN_MORE 255 // Length byte after which another one follows
+
+// LZ77 codec for the blocks of the image. Each sequence is a token with
+// the literal and match lengths, the literals, and a 16 bit offset back to
+// the match; the last sequence has only literals.
+size_t lz_compress(const char *src, size_t len, char *dst, size_t cap);
+size_t lz_decompress(const char *src, size_t len, char *dst, size_t cap);
+
+#endif  // LZ_H_
@@ -0,0 +1,166 @@
+#include <stdlib.h>
+#include <string.h>
+#include "names.h"
+#include "hash.h"
+
+// Interned name, shared by every inode with the same name
+typedef struct name_entry {
+	char *name;
+	uint32_t refs;
+	name_id_t next;  // Next entry in the bucket, or in the free list
+} name_entry_t;
+
+static name_entry_t *entries;
+static size_t entries_capacity;
+static size_t entries_top = FIRST_NAME;
+static size_t entries_amount;
+static name_id_t free_head = NO_NAME;
+
+// Hash buckets chained through name_entry_t.next
+static name_id_t *buckets;
+static size_t buckets_amount;
+
+// Hash of a name
+static uint32_t
+name_hash(const char *name)
+{
+	return fnv1a_str(name);
+}
+
+// Double the buckets and rehash every entry once they are too loaded
+static int
+grow_buckets()
+{
+	size_t amount = buckets_amount ? buckets_amount * 2
+	                               : NAMES_INITIAL_BUCKETS;
+	name_id_t *new_buckets = calloc(amount, sizeof(name_id_t));
+	if (new_buckets == NULL) {
+		return -1;
+	}
+	for (size_t id = FIRST_NAME; id < entries_top; id++) {
+		if (entries[id].refs == 0) {
+			continue;
+		}
+		size_t bucket = name_hash(entries[id].name) & (amount - 1);
+		entries[id].next = new_buckets[bucket];
+		new_buckets[bucket] = id;
+	}
+	free(buckets);
+	buckets = new_buckets;
+	buckets_amount = amount;
+	return 0;
+}
+
+// Get a free entry id, growing the table if needed
+static name_id_t
+new_entry()
+{
+	if (free_head != NO_NAME) {
+		name_id_t id = free_head;
+		free_head = entries[id].next;
+		return id;
+	}
+	if (entries_top >= entries_capacity) {
+		size_t capacity = entries_capacity ? entries_capacity * 2
+		                                   : NAMES_INITIAL_CAPACITY;
+		name_entry_t *new_entries =
+		        realloc(entries, capacity * sizeof(name_entry_t));
+		if (new_entries == NULL) {
+			return NO_NAME;
+		}
+		entries = new_entries;
+		entries_capacity = capacity;
+	}
+	return entries_top++;
+}
+
+// Find the id of an interned name without taking a reference
+name_id_t
+name_find(const char *name)
+{
+	if (buckets_amount == 0) {
+		return NO_NAME;
+	}
+	name_id_t id = buckets[name_hash(name) & (buckets_amount - 1)];
+	while (id != NO_NAME && strcmp(entries[id].name, name) != 0) {
+		id = entries[id].next;
+	}
+	return id;
+}
+
+// Take a reference to name, interning it if needed
+name_id_t
+name_intern(const char *name)
+{
+	name_id_t id = name_find(name);
+	if (id != NO_NAME) {
+		entries[id].refs++;
+		return id;
+	}
+	if (entries_amount >= buckets_amount && grow_buckets() != 0) {
+		return NO_NAME;
+	}
+	size_t len = strlen(name) + 1;
+	char *copy = malloc(len);
+	if (copy == NULL) {
+		return NO_NAME;
+	}
+	memcpy(copy, name, len);
+	id = new_entry();
+	if (id == NO_NAME) {
+		free(copy);
+		return NO_NAME;
+	}
+	size_t bucket = name_hash(name) & (buckets_amount - 1);
+	entries[id].name = copy;
+	entries[id].refs = 1;
+	entries[id].next = buckets[bucket];
+	buckets[bucket] = id;
+	entries_amount++;
+	return id;
+}
+
+// Get the string of an interned name
+const char *
+name_get(name_id_t id)
+{
+	return entries[id].name;
+}
+
+// Drop a reference to a name, freeing it with the last one
+void
+name_release(name_id_t id)
+{
+	if (id == NO_NAME || --entries[id].refs > 0) {
+		return;
+	}
+	name_id_t *link = &buckets[name_hash(entries[id].name) &
+	                           (buckets_amount - 1)];
+	while (*link != id) {
+		link = &entries[*link].next;
+	}
+	*link = entries[id].next;
+	free(entries[id].name);
+	entries[id].name = NULL;
+	entries[id].next = free_head;
+	free_head = id;
+	entries_amount--;
+}
+
+// Release every interned name
+void
+names_reset()
+{
+	for (size_t id = FIRST_NAME; id < entries_top; id++) {
+		free(entries[id].name);
+	}
+	free(entries);
+	free(buckets);
+	entries = NULL;
+	buckets = NULL;
+	entries_capacity = 0;
+	entries_top = FIRST_NAME;
+	entries_amount = 0;
+	buckets_amount = 0;
+	free_head = NO_NAME;
+}
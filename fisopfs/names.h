@@ -0,0 +1,20 @@
+#ifndef NAMES_H_
+#define NAMES_H_
+#include <stddef.h>
+#include <stdint.h>
+
+#define NO_NAME 0 // Name id that never refers to a name
+#define FIRST_NAME 1 // First valid name id
+#define NAMES_INITIAL_CAPACITY 64 // Initial size of the name table
+#define NAMES_INITIAL_BUCKETS 64 // Initial buckets of the name hash (power of two)
+
+typedef uint32_t name_id_t;
+
+// Interned names functions
+name_id_t name_intern(const char *name);
+name_id_t name_find(const char *name);
+const char *name_get(name_id_t id);
+void name_release(name_id_t id);
+void names_reset();
+
+#endif  // NAMES_H_
@@ -0,0 +1,226 @@
+#define _GNU_SOURCE
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include "stats.h"
+
+#define NS_PER_SEC 1000000000ull
+#define NS_PER_US 1000.0
+#define STATS_P50 50 // Percentiles reported, out of 100
+#define STATS_P99 99
+
+static const char *op_names[STAT_OPS] = {
+	"lookup", "getattr", "setattr", "readdir", "open",  "read",  "write",     "create",
+	"mkdir",  "unlink",  "rmdir",   "rename",  "flush", "fsync", "fallocate", "serialize"
+};
+
+// Counts of one operation
+typedef struct stats_counter {
+	uint64_t calls;
+	uint64_t errors;
+	uint64_t bytes;
+	uint64_t ns;
+	uint64_t buckets[STATS_BUCKETS];
+} stats_counter_t;
+
+// Counters of one thread. Only the thread that holds the slot writes them,
+// without locks, and readers add up every slot. A thread that exits leaves
+// its slot, with what it counted, to the next one that starts.
+typedef struct stats_slot {
+	stats_counter_t ops[STAT_OPS];
+	bool in_use;
+	struct stats_slot *next;
+} stats_slot_t;
+
+// Every slot ever created, pushed at the head and never freed
+static stats_slot_t *slots;
+static _Thread_local stats_slot_t *own_slot;
+// Gives the slot back when its thread exits
+static pthread_key_t slot_key;
+static pthread_once_t slot_key_once = PTHREAD_ONCE_INIT;
+
+static void
+slot_release(void *slot)
+{
+	__atomic_store_n(&((stats_slot_t *) slot)->in_use, false, __ATOMIC_RELEASE);
+}
+
+static void
+slot_key_create()
+{
+	pthread_key_create(&slot_key, slot_release);
+}
+
+// Slot of the calling thread, taking a free one or adding a new one the
+// first time. NULL if there is no memory for it.
+static stats_slot_t *
+slot_get()
+{
+	if (own_slot != NULL) {
+		return own_slot;
+	}
+	pthread_once(&slot_key_once, slot_key_create);
+	stats_slot_t *slot = __atomic_load_n(&slots, __ATOMIC_ACQUIRE);
+	for (; slot != NULL; slot = slot->next) {
+		bool expected = false;
+		if (__atomic_compare_exchange_n(
+		            &slot->in_use, &expected, true, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+			break;
+		}
+	}
+	if (slot == NULL) {
+		slot = calloc(1, sizeof(stats_slot_t));
+		if (slot == NULL) {
+			return NULL;
+		}
+		slot->in_use = true;
+		slot->next = __atomic_load_n(&slots, __ATOMIC_RELAXED);
+		while (!__atomic_compare_exchange_n(
+		        &slots, &slot->next, slot, true, __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
+		}
+	}
+	pthread_setspecific(slot_key, slot);
+	own_slot = slot;
+	return slot;
+}
+
+// Add n to a counter of the calling thread's slot, which no one else
+// writes, so that readers never see it torn
+static void
+counter_add(uint64_t *counter, uint64_t n)
+{
+	__atomic_store_n(counter, *counter + n, __ATOMIC_RELAXED);
+}
+
+// Histogram bucket of a latency of ns nanoseconds
+static int
+bucket_of(uint64_t ns)
+{
+	int bucket = ns == 0 ? 0 : 63 - __builtin_clzll(ns);
+	return bucket < STATS_BUCKETS ? bucket : STATS_BUCKETS - 1;
+}
+
+// Current time in nanoseconds, to be given to stats_done
+uint64_t
+stats_start()
+{
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * NS_PER_SEC + ts.tv_nsec;
+}
+
+// Count an operation that started at start and returned res: an error if
+// negative, bytes moved if positive. Returns res.
+long
+stats_done(stats_op_t op, uint64_t start, long res)
+{
+	stats_record(op, stats_start() - start, res > 0 ? res : 0, res < 0);
+	return res;
+}
+
+// Count an operation that took ns nanoseconds and moved bytes
+void
+stats_record(stats_op_t op, uint64_t ns, uint64_t bytes, bool error)
+{
+	stats_slot_t *slot = slot_get();
+	if (slot == NULL) {
+		return;
+	}
+	stats_counter_t *counter = &slot->ops[op];
+	counter_add(&counter->calls, 1);
+	counter_add(&counter->errors, error);
+	counter_add(&counter->bytes, bytes);
+	counter_add(&counter->ns, ns);
+	counter_add(&counter->buckets[bucket_of(ns)], 1);
+}
+
+// Upper bound in microseconds of the latency under which percent of the
+// calls counted in total fall
+static double
+percentile(const stats_counter_t *sum, int percent)
+{
+	uint64_t wanted = (sum->calls * percent + 99) / 100;
+	uint64_t seen = 0;
+	for (int b = 0; b < STATS_BUCKETS; b++) {
+		seen += sum->buckets[b];
+		if (seen >= wanted) {
+			return (double) (2ull << b) / NS_PER_US;
+		}
+	}
+	return 0;
+}
+
+// Write the statistics of every operation as text into buf, one line each
+// after a header. Returns their length, at most len - 1.
+size_t
+stats_format(char *buf, size_t len)
+{
+	stats_counter_t sums[STAT_OPS];
+	memset(sums, 0, sizeof(sums));
+	stats_slot_t *slot = __atomic_load_n(&slots, __ATOMIC_ACQUIRE);
+	for (; slot != NULL; slot = slot->next) {
+		for (int op = 0; op < STAT_OPS; op++) {
+			const uint64_t *from = (const uint64_t *) &slot->ops[op];
+			uint64_t *to = (uint64_t *) &sums[op];
+			for (size_t k = 0; k < sizeof(stats_counter_t) / sizeof(uint64_t); k++) {
+				to[k] += __atomic_load_n(&from[k], __ATOMIC_RELAXED);
+			}
+		}
+	}
+	size_t used = snprintf(buf,
+	                       len,
+	                       "%-10s %12s %8s %14s %10s %10s %10s\n",
+	                       "op",
+	                       "calls",
+	                       "errors",
+	                       "bytes",
+	                       "avg_us",
+	                       "p50_us",
+	                       "p99_us");
+	for (int op = 0; op < STAT_OPS && used < len; op++) {
+		const stats_counter_t *sum = &sums[op];
+		used += snprintf(buf + used,
+		                 len - used,
+		                 "%-10s %12ju %8ju %14ju %10.1f %10.1f %10.1f\n",
+		                 op_names[op],
+		                 (uintmax_t) sum->calls,
+		                 (uintmax_t) sum->errors,
+		                 (uintmax_t) sum->bytes,
+		                 sum->calls ? sum->ns / NS_PER_US / sum->calls : 0,
+		                 percentile(sum, STATS_P50),
+		                 percentile(sum, STATS_P99));
+	}
+	return used < len ? used : len - 1;
+}
+
+// Read size bytes of the statistics from offset into buf, as reading
+// STATS_FILE does. Returns the bytes read.
+size_t
+stats_read(char *buf, size_t size, off_t offset)
+{
+	char text[STATS_MAX_LEN];
+	size_t len = stats_format(text, sizeof(text));
+	if (offset < 0 || (size_t) offset >= len) {
+		return 0;
+	}
+	size_t n = len - offset < size ? len - offset : size;
+	memcpy(buf, text + offset, n);
+	return n;
+}
+
+// Attributes of STATS_FILE, whose size is that of the statistics now
+void
+stats_stat(struct stat *st)
+{
+	char buf[STATS_MAX_LEN];
+	memset(st, 0, sizeof(struct stat));
+	st->st_mode = STATS_FILE_MODE;
+	st->st_nlink = 1;
+	st->st_uid = getuid();
+	st->st_gid = getgid();
+	st->st_size = stats_format(buf, sizeof(buf));
+	st->st_atime = st->st_mtime = st->st_ctime = time(NULL);
+}
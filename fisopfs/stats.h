@@ -0,0 +1,43 @@
+#ifndef STATS_H_
+#define STATS_H_
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+#define STATS_FILE ".fisopfs_stats" // Read-only file at the root with the statistics
+#define STATS_BUCKETS 40 // Latency histogram buckets, bucket k counts [2^k, 2^(k+1)) ns
+#define STATS_MAX_LEN 4096 // Room for the text of the statistics
+#define STATS_FILE_MODE (__S_IFREG | 0444)
+
+// Operations with their own counters
+typedef enum {
+	STAT_LOOKUP,
+	STAT_GETATTR,
+	STAT_SETATTR,
+	STAT_READDIR,
+	STAT_OPEN,
+	STAT_READ,
+	STAT_WRITE,
+	STAT_CREATE,
+	STAT_MKDIR,
+	STAT_UNLINK,
+	STAT_RMDIR,
+	STAT_RENAME,
+	STAT_FLUSH,
+	STAT_FSYNC,
+	STAT_FALLOCATE,
+	STAT_SERIALIZE,
+	STAT_OPS
+} stats_op_t;
+
+// Statistics functions
+uint64_t stats_start();
+long stats_done(stats_op_t op, uint64_t start, long res);
+void stats_record(stats_op_t op, uint64_t ns, uint64_t bytes, bool error);
+size_t stats_format(char *buf, size_t len);
+size_t stats_read(char *buf, size_t size, off_t offset);
+void stats_stat(struct stat *st);
+
+#endif  // STATS_H_
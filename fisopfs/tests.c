@@ -1,4 +1,5 @@
 #define _GNU_SOURCE
+#include <signal.h>
 #include "fs.h"
 #include "tester.h"
 
@@ -8,6 +9,30 @@
 #define PERM_ALL 0777
 #define PERM_PRIVATE 0600
 #define MODE_0644 (S_IRUSR | S_IWUSR | S_IRGRP | S_IROTH)
+#define LARGE_FILE_SIZE (64 * 1024)
+#define RANDOM_FILE_SIZE (256 * 1024) // Largest file of the random reads and writes
+#define RANDOM_MAX_IO (64 * 1024) // Largest random read or write
+#define RANDOM_OPS 500
+#define RANDOM_SEED 42
+#define PAGED_ENTRIES 200 // Files of the directory listed a few entries at a time
+#define PAGED_BUFFER 256 // Bytes of each getdents64, room for a few entries
+#define PAGED_ENTRY "%s/dir_paginado/entrada_%03d"
+#define FALLOC_BLOCKS 3 // Blocks of the file given to fallocate
+#define BLOCK_SECTORS (FS_BLOCK_SIZE / STAT_BLOCK_SIZE) // st_blocks of a block
+#define CACHE_EXPIRED_US 1100000 // Past the second the kernel caches attributes
+#define REMOUNT_POINT "prueba_remontada" // Where the tests mount a fisopfs of their own
+#define REMOUNT_DISK "prueba_remontada.fisopfs" // Its image
+#define FISOPFS_BIN "./fisopfs"
+#define FUSERMOUNT "fusermount"
+#define MOUNT_TIMEOUT_US 10000000 // To wait for fisopfs to mount
+#define MOUNT_POLL_US 1000 // Between checks of whether it mounted
+#define MAX_MOUNT_ARGS 16
+#define STATS_DIRS 3 // Directories created and removed before reading the statistics
+#define STATS_WRITE_SIZE 1000
+#define REMOUNT_FILE_SIZE (3 * FS_BLOCK_SIZE + 100) // Files written before remounting
+#define LONG_PATH (MAX_DEPTH * (MAX_NAME_LEN + 1) + MAX_PATH_NAME) // Path of names as long as allowed
+
+static pid_t fisopfs_pid = -1;
 
 void
 test_fisopfs_mkdir_and_rmdir()
@@ -22,7 +47,7 @@ test_fisopfs_mkdir_and_rmdir()
 	res = mkdir(path, DIR_PERM);
 	assert(res != 0, "mkdir no puede crear un directorio que ya existe");
 	char sub_path[MAX_PATH_NAME];
-	snprintf(sub_path, sizeof(sub_path), "%s/sd", path);
+	snprintf(sub_path, sizeof(sub_path), "%s/dir_prueba/sd", TEST_ROOT);
 	res = mkdir(sub_path, DIR_PERM);
 	assert(res == 0, "mkdir puede crear un directorio dentro de otro");
 
@@ -139,6 +164,42 @@ test_utimens()
 	assert(res == 0, "utimens actualiza tiempos correctamente");
 }
 
+// Read a byte of the file at path
+static void
+read_byte(const char *path)
+{
+	char c;
+	int fd = open(path, O_RDONLY);
+	read(fd, &c, 1);
+	close(fd);
+}
+
+void
+test_fisopfs_relatime()
+{
+	head("Tests fecha de acceso (relatime)");
+	char path[MAX_PATH_NAME];
+	snprintf(path, sizeof(path), "%s/archivo_atime.txt", TEST_ROOT);
+	unlink(path);
+	int fd = open(path, O_CREAT | O_WRONLY | O_EXCL, MODE_0644);
+	write(fd, "x", 1);
+	close(fd);
+	struct stat escrito, primera, segunda;
+	stat(path, &escrito);
+	usleep(CACHE_EXPIRED_US);
+	read_byte(path);
+	usleep(CACHE_EXPIRED_US);
+	stat(path, &primera);
+	assert(primera.st_atime > escrito.st_mtime,
+	       "la primera lectura tras escribir mueve la fecha de acceso");
+	read_byte(path);
+	usleep(CACHE_EXPIRED_US);
+	stat(path, &segunda);
+	assert(segunda.st_atime == primera.st_atime,
+	       "leer de nuevo no mueve la fecha de acceso");
+	unlink(path);
+}
+
 void
 test_fisopfs_write_and_read()
 {
@@ -204,6 +265,234 @@ test_fisopfs_write_and_read()
 	unlink(path_append);
 }
 
+void
+test_fisopfs_large_file()
+{
+	head("Tests archivos grandes");
+
+	char path[MAX_PATH_NAME];
+	snprintf(path, sizeof(path), "%s/archivo_grande.bin", TEST_ROOT);
+	unlink(path);
+	static char contenido[LARGE_FILE_SIZE], leido[LARGE_FILE_SIZE];
+	for (int i = 0; i < LARGE_FILE_SIZE; i++)
+		contenido[i] = 'a' + i % 26;
+	int fd = open(path, O_CREAT | O_WRONLY | O_EXCL, MODE_0644);
+	assert(fd >= 0, "open crea un archivo grande exitosamente");
+	ssize_t escrito = write(fd, contenido, sizeof(contenido));
+	assert(escrito == LARGE_FILE_SIZE, "write escribe mas de un bloque");
+	close(fd);
+	fd = open(path, O_RDONLY);
+	ssize_t total = 0, n;
+	while ((n = read(fd, leido + total, sizeof(leido) - total)) > 0)
+		total += n;
+	close(fd);
+	assert(total == LARGE_FILE_SIZE, "read lee el archivo grande completo");
+	assert(memcmp(contenido, leido, sizeof(leido)) == 0,
+	       "read lee el contenido correcto del archivo grande");
+	assert(truncate(path, 10) == 0, "truncate achica el archivo grande");
+	struct stat st;
+	assert(stat(path, &st) == 0 && st.st_size == 10,
+	       "stat refleja el tamaño tras truncate");
+	unlink(path);
+}
+
+// Write, read and truncate a file at random offsets and sizes, checking
+// every read against a copy of what the file should hold
+void
+test_fisopfs_random_io()
+{
+	head("Tests lecturas y escrituras al azar");
+
+	char path[MAX_PATH_NAME];
+	snprintf(path, sizeof(path), "%s/archivo_azar.bin", TEST_ROOT);
+	unlink(path);
+	static char modelo[RANDOM_FILE_SIZE], datos[RANDOM_MAX_IO],
+	        leido[RANDOM_FILE_SIZE];
+	memset(modelo, 0, sizeof(modelo));
+	off_t size = 0;
+	int fd = open(path, O_CREAT | O_RDWR | O_EXCL, MODE_0644);
+	assert(fd >= 0, "open crea el archivo de lecturas al azar");
+	srand(RANDOM_SEED);
+	int errores = 0;
+	for (int i = 0; i < RANDOM_OPS; i++) {
+		off_t offset = rand() % RANDOM_FILE_SIZE;
+		size_t len = 1 + rand() % RANDOM_MAX_IO;
+		if (offset + len > RANDOM_FILE_SIZE)
+			len = RANDOM_FILE_SIZE - offset;
+		int op = rand() % 10;
+		if (op < 5) {
+			for (size_t j = 0; j < len; j++)
+				datos[j] = rand() % 4 ? 'a' + rand() % 26 : 0;
+			if (pwrite(fd, datos, len, offset) != (ssize_t) len)
+				errores++;
+			memcpy(modelo + offset, datos, len);
+			if (offset + (off_t) len > size)
+				size = offset + len;
+		} else if (op < 6) {
+			if (ftruncate(fd, offset) != 0)
+				errores++;
+			if (offset < size)
+				memset(modelo + offset, 0, size - offset);
+			size = offset;
+		} else {
+			ssize_t esperado = 0;
+			if (offset < size)
+				esperado = size - offset < (off_t) len ? size - offset : len;
+			ssize_t n = pread(fd, leido, len, offset);
+			if (n != esperado || memcmp(leido, modelo + offset, n) != 0)
+				errores++;
+		}
+	}
+	close(fd);
+	assert(errores == 0, "cada lectura al azar coincide con lo escrito");
+	struct stat st;
+	assert(stat(path, &st) == 0 && st.st_size == size,
+	       "el tamaño final coincide con lo escrito");
+	fd = open(path, O_RDONLY);
+	ssize_t total = 0, n;
+	while ((n = read(fd, leido + total, sizeof(leido) - total)) > 0)
+		total += n;
+	close(fd);
+	assert(total == size && memcmp(leido, modelo, size) == 0,
+	       "el archivo completo coincide con lo escrito");
+	unlink(path);
+}
+
+// Create the file at path holding the len bytes of data
+bool
+write_whole(const char *path, const char *data, size_t len)
+{
+	int fd = open(path, O_CREAT | O_WRONLY | O_TRUNC, MODE_0644);
+	if (fd < 0)
+		return false;
+	bool escrito = write(fd, data, len) == (ssize_t) len;
+	return close(fd) == 0 && escrito;
+}
+
+// Whether the file at path holds exactly the len bytes of data
+bool
+has_contents(const char *path, const char *data, size_t len)
+{
+	struct stat st;
+	int fd = open(path, O_RDONLY);
+	if (fd < 0 || fstat(fd, &st) != 0 || st.st_size != (off_t) len) {
+		if (fd >= 0)
+			close(fd);
+		return false;
+	}
+	bool iguales = true;
+	char leido[FS_BLOCK_SIZE];
+	for (size_t pos = 0; pos < len && iguales; pos += sizeof(leido)) {
+		size_t n = len - pos < sizeof(leido) ? len - pos : sizeof(leido);
+		iguales = pread(fd, leido, n, pos) == (ssize_t) n &&
+		          memcmp(leido, data + pos, n) == 0;
+	}
+	close(fd);
+	return iguales;
+}
+
+// Whether the len bytes of the file at fd from offset all hold value
+bool
+holds(int fd, off_t offset, size_t len, char value)
+{
+	char leido[FS_BLOCK_SIZE];
+	for (size_t pos = 0; pos < len; pos += sizeof(leido)) {
+		size_t n = len - pos < sizeof(leido) ? len - pos : sizeof(leido);
+		if (pread(fd, leido, n, offset + pos) != (ssize_t) n)
+			return false;
+		for (size_t i = 0; i < n; i++)
+			if (leido[i] != value)
+				return false;
+	}
+	return true;
+}
+
+void
+test_fisopfs_fallocate()
+{
+	head("Tests fallocate");
+	char path[MAX_PATH_NAME];
+	snprintf(path, sizeof(path), "%s/archivo_fallocate.bin", TEST_ROOT);
+	unlink(path);
+	const off_t largo = FALLOC_BLOCKS * FS_BLOCK_SIZE;
+	int fd = open(path, O_CREAT | O_RDWR | O_EXCL, MODE_0644);
+	assert(fallocate(fd, 0, 0, largo) == 0, "fallocate agranda el archivo");
+	struct stat st;
+	fstat(fd, &st);
+	assert(st.st_size == largo, "el tamaño llega al final del rango");
+	assert(st.st_blocks == 0, "fallocate no reserva bloques, quedan huecos");
+	assert(holds(fd, 0, largo, 0), "los huecos se leen como ceros");
+
+	static char contenido[FALLOC_BLOCKS * FS_BLOCK_SIZE];
+	memset(contenido, 'x', sizeof(contenido));
+	pwrite(fd, contenido, sizeof(contenido), 0);
+	fstat(fd, &st);
+	assert(st.st_blocks == FALLOC_BLOCKS * BLOCK_SECTORS,
+	       "escribir los huecos pide sus bloques");
+	int res = fallocate(fd,
+	                    FALLOC_FL_PUNCH_HOLE | FALLOC_FL_KEEP_SIZE,
+	                    FS_BLOCK_SIZE,
+	                    FS_BLOCK_SIZE);
+	assert(res == 0, "fallocate hace un hueco manteniendo el tamaño");
+	fstat(fd, &st);
+	assert(st.st_size == largo, "hacer un hueco no cambia el tamaño");
+	assert(st.st_blocks == (FALLOC_BLOCKS - 1) * BLOCK_SECTORS,
+	       "hacer un hueco libera el bloque");
+	assert(holds(fd, FS_BLOCK_SIZE, FS_BLOCK_SIZE, 0), "el hueco se lee como ceros");
+	assert(holds(fd, 0, FS_BLOCK_SIZE, 'x') &&
+	               holds(fd, 2 * FS_BLOCK_SIZE, FS_BLOCK_SIZE, 'x'),
+	       "el resto del archivo queda igual");
+	assert(fallocate(fd, FALLOC_FL_KEEP_SIZE, largo, largo) == 0,
+	       "fallocate con FALLOC_FL_KEEP_SIZE pasado el final");
+	fstat(fd, &st);
+	assert(st.st_size == largo, "FALLOC_FL_KEEP_SIZE no cambia el tamaño");
+	close(fd);
+	unlink(path);
+
+	snprintf(path, sizeof(path), "%s/%s", MOUNT_POINT, STATS_FILE);
+	fd = open(path, O_RDONLY);
+	assert(fd >= 0 && fallocate(fd, 0, 0, largo) != 0,
+	       "fallocate sobre el archivo de estadísticas falla");
+	close(fd);
+}
+
+// st_blocks of the file at fd
+blkcnt_t
+blocks_of(int fd)
+{
+	struct stat st;
+	return fstat(fd, &st) == 0 ? st.st_blocks : -1;
+}
+
+void
+test_fisopfs_statfs()
+{
+	head("Tests statfs");
+	char path[MAX_PATH_NAME];
+	snprintf(path, sizeof(path), "%s/archivo_statfs.bin", TEST_ROOT);
+	unlink(path);
+	// Every block different, so none is shared with --dedup
+	static char contenido[LARGE_FILE_SIZE];
+	for (int i = 0; i < LARGE_FILE_SIZE; i++)
+		contenido[i] = (i * 7 + i / FS_BLOCK_SIZE * 13) % 251;
+	struct statvfs antes, despues, borrado;
+	assert(statvfs(TEST_ROOT, &antes) == 0, "statvfs responde");
+	assert(antes.f_blocks > 0 && antes.f_bfree <= antes.f_blocks,
+	       "statvfs informa un tamaño y lo libre dentro de él");
+	assert(antes.f_bsize == FS_BLOCK_SIZE, "statvfs informa bloques de 4 KiB");
+	int fd = open(path, O_CREAT | O_WRONLY | O_EXCL, MODE_0644);
+	write(fd, contenido, sizeof(contenido));
+	close(fd);
+	statvfs(TEST_ROOT, &despues);
+	assert((despues.f_blocks - despues.f_bfree) - (antes.f_blocks - antes.f_bfree) ==
+	               LARGE_FILE_SIZE / FS_BLOCK_SIZE,
+	       "los bloques usados crecen con lo escrito");
+	unlink(path);
+	statvfs(TEST_ROOT, &borrado);
+	assert(borrado.f_blocks - borrado.f_bfree == antes.f_blocks - antes.f_bfree,
+	       "borrar el archivo libera sus bloques");
+}
+
 void
 test_types_read()
 {
@@ -215,6 +504,8 @@ test_types_read()
 	assert(fd >= 0, "open crea un archivo para escritura exitosamente");
 	const char *content = "Contenido de prueba";
 	ssize_t escrito = write(fd, content, strlen(content));
+	assert(escrito == (ssize_t) strlen(content), "write escribe el contenido");
+	close(fd);
 
 	// cat more less
 }
@@ -225,16 +516,16 @@ test_fisopfs_readdir()
 	head("Tests readdir");
 	char dir_path[MAX_PATH_NAME];
 	snprintf(dir_path, sizeof(dir_path), "%s/dir_readdir", TEST_ROOT);
-	int res = mkdir(dir_path, DIR_PERM);
+	mkdir(dir_path, DIR_PERM);
 	char file1[MAX_PATH_NAME], file2[MAX_PATH_NAME], subdir[MAX_PATH_NAME];
-	snprintf(file1, sizeof(file1), "%s/archivo1.txt", dir_path);
-	snprintf(file2, sizeof(file2), "%s/archivo2.txt", dir_path);
-	snprintf(subdir, sizeof(subdir), "%s/subdir", dir_path);
+	snprintf(file1, sizeof(file1), "%s/dir_readdir/archivo1.txt", TEST_ROOT);
+	snprintf(file2, sizeof(file2), "%s/dir_readdir/archivo2.txt", TEST_ROOT);
+	snprintf(subdir, sizeof(subdir), "%s/dir_readdir/subdir", TEST_ROOT);
 	int fd1 = creat(file1, MODE_0644);
 	int fd2 = creat(file2, MODE_0644);
 	close(fd1);
 	close(fd2);
-	res = mkdir(subdir, DIR_PERM);
+	mkdir(subdir, DIR_PERM);
 	DIR *d = opendir(dir_path);
 	struct dirent *entry;
 	int tiene_archivo1 = 0, tiene_archivo2 = 0, tiene_subdir = 0;
@@ -253,7 +544,211 @@ test_fisopfs_readdir()
 	unlink(file1);
 	unlink(file2);
 	rmdir(subdir);
-	rmdir(dir_path);
+	d = opendir(dir_path);
+	int entradas = 0;
+	while ((entry = readdir(d)) != NULL)
+		entradas++;
+	closedir(d);
+	assert(entradas == 2, "readdir solo lista . y .. tras vaciar el directorio");
+	assert(rmdir(dir_path) == 0, "rmdir elimina el directorio luego de vaciarlo");
+}
+
+void
+test_fisopfs_readdir_paged()
+{
+	head("Tests readdir con entradas borradas entre páginas");
+	char dir_path[MAX_PATH_NAME], path[MAX_PATH_NAME];
+	snprintf(dir_path, sizeof(dir_path), "%s/dir_paginado", TEST_ROOT);
+	mkdir(dir_path, DIR_PERM);
+	for (int i = 0; i < PAGED_ENTRIES; i++) {
+		snprintf(path, sizeof(path), PAGED_ENTRY, TEST_ROOT, i);
+		close(creat(path, MODE_0644));
+	}
+	int vistas[PAGED_ENTRIES] = { 0 };
+	bool borrada[PAGED_ENTRIES] = { false };
+	int fd = open(dir_path, O_RDONLY | O_DIRECTORY);
+	// Aligned for the entries, and at least as big as one
+	union {
+		struct dirent64 entrada;
+		char bytes[PAGED_BUFFER];
+	} buffer;
+	ssize_t leidos;
+	int llamadas = 0;
+	while ((leidos = getdents64(fd, buffer.bytes, sizeof(buffer))) > 0) {
+		llamadas++;
+		int ultima = -1;
+		for (ssize_t pos = 0; pos < leidos;) {
+			struct dirent64 *entry = (struct dirent64 *) (buffer.bytes + pos);
+			int numero;
+			if (sscanf(entry->d_name, "entrada_%d", &numero) == 1) {
+				vistas[numero]++;
+				ultima = numero;
+			}
+			pos += entry->d_reclen;
+		}
+		// The next page starts at a neighbour of the last entry listed
+		for (int i = ultima - 1; i <= ultima + 1 && ultima >= 0; i += 2) {
+			if (i >= 0 && i < PAGED_ENTRIES && !vistas[i] && !borrada[i]) {
+				snprintf(path, sizeof(path), PAGED_ENTRY, TEST_ROOT, i);
+				borrada[i] = unlink(path) == 0;
+			}
+		}
+	}
+	close(fd);
+	int faltan = 0, repetidas = 0;
+	for (int i = 0; i < PAGED_ENTRIES; i++) {
+		faltan += !vistas[i] && !borrada[i];
+		repetidas += vistas[i] > 1;
+	}
+	assert(llamadas > 2, "el directorio se lista en varias llamadas");
+	assert(faltan == 0, "borrar la entrada siguiente no corta el listado");
+	assert(repetidas == 0, "ninguna entrada aparece dos veces");
+	for (int i = 0; i < PAGED_ENTRIES; i++) {
+		snprintf(path, sizeof(path), PAGED_ENTRY, TEST_ROOT, i);
+		unlink(path);
+	}
+	assert(rmdir(dir_path) == 0, "el directorio queda vacío");
+}
+
+void
+test_fisopfs_rename()
+{
+	head("Tests rename");
+	char origen[MAX_PATH_NAME], destino[MAX_PATH_NAME], otro[MAX_PATH_NAME];
+	snprintf(origen, sizeof(origen), "%s/renombrar_a.txt", TEST_ROOT);
+	snprintf(destino, sizeof(destino), "%s/renombrar_b.txt", TEST_ROOT);
+	snprintf(otro, sizeof(otro), "%s/renombrar_c.txt", TEST_ROOT);
+	int fd = open(origen, O_CREAT | O_WRONLY | O_TRUNC, MODE_0644);
+	write(fd, "hola", 4);
+	close(fd);
+	assert(rename(origen, destino) == 0, "rename cambia el nombre de un archivo");
+	assert(access(origen, F_OK) != 0, "el nombre viejo ya no existe");
+	char leido[8] = { 0 };
+	fd = open(destino, O_RDONLY);
+	read(fd, leido, sizeof(leido));
+	close(fd);
+	assert(strcmp(leido, "hola") == 0, "el archivo conserva su contenido");
+
+	fd = open(otro, O_CREAT | O_WRONLY | O_TRUNC, MODE_0644);
+	write(fd, "chau", 4);
+	close(fd);
+	assert(rename(destino, otro) == 0, "rename reemplaza un archivo existente");
+	memset(leido, 0, sizeof(leido));
+	fd = open(otro, O_RDONLY);
+	read(fd, leido, sizeof(leido));
+	close(fd);
+	assert(strcmp(leido, "hola") == 0 && access(destino, F_OK) != 0,
+	       "el reemplazado tiene el contenido del movido");
+	unlink(otro);
+
+	char dir[MAX_PATH_NAME], sub[MAX_PATH_NAME], adentro[MAX_PATH_NAME];
+	snprintf(dir, sizeof(dir), "%s/r1", TEST_ROOT);
+	snprintf(sub, sizeof(sub), "%s/r1/r2", TEST_ROOT);
+	snprintf(adentro, sizeof(adentro), "%s/r1/r2/r1", TEST_ROOT);
+	mkdir(dir, DIR_PERM);
+	mkdir(sub, DIR_PERM);
+	assert(rename(dir, adentro) != 0 && errno == EINVAL,
+	       "no se puede mover un directorio dentro de sí mismo");
+
+	char lejos[MAX_PATH_NAME], lejos_sub[MAX_PATH_NAME];
+	snprintf(lejos, sizeof(lejos), "%s/s1", TEST_ROOT);
+	snprintf(lejos_sub, sizeof(lejos_sub), "%s/s1/s2", TEST_ROOT);
+	mkdir(lejos, DIR_PERM);
+	mkdir(lejos_sub, DIR_PERM);
+	snprintf(destino, sizeof(destino), "%s/s1/s2/r1", TEST_ROOT);
+	assert(rename(dir, destino) != 0 && errno == ENAMETOOLONG,
+	       "rename no deja un subdirectorio más profundo que el límite");
+	snprintf(destino, sizeof(destino), "%s/s1/s2/r2", TEST_ROOT);
+	assert(rename(sub, destino) == 0,
+	       "rename mueve un directorio vacío hasta el límite");
+	char movido[MAX_PATH_NAME];
+	snprintf(movido, sizeof(movido), "%s/s1/s2/r1", TEST_ROOT);
+	assert(rename(dir, movido) == 0,
+	       "sin su subdirectorio el directorio ya entra en el límite");
+	rmdir(movido);
+	rmdir(destino);
+	rmdir(lejos_sub);
+	rmdir(lejos);
+}
+
+// appends to path a component of MAX_NAME_LEN copies of letter
+static void
+append_long_name(char *path, char letter)
+{
+	size_t len = strlen(path);
+	path[len++] = '/';
+	memset(path + len, letter, MAX_NAME_LEN);
+	path[len + MAX_NAME_LEN] = STRING_END;
+}
+
+void
+test_fisopfs_long_names()
+{
+	head("Tests nombres largos");
+	char dir[LONG_PATH], sub[LONG_PATH], archivo[LONG_PATH],
+	        destino[LONG_PATH], otro_dir[LONG_PATH];
+	snprintf(dir, sizeof(dir), "%s", TEST_ROOT);
+	append_long_name(dir, 'a');
+	strcpy(sub, dir);
+	append_long_name(sub, 'b');
+	strcpy(archivo, sub);
+	append_long_name(archivo, 'c');
+	assert(mkdir(dir, DIR_PERM) == 0 && mkdir(sub, DIR_PERM) == 0,
+	       "se crean directorios con nombres del largo máximo");
+	int fd = open(archivo, O_CREAT | O_WRONLY | O_TRUNC, MODE_0644);
+	assert(fd >= 0, "se crea un archivo cuyo path supera MAX_PATH_NAME");
+	close(fd);
+
+	strcpy(destino, sub);
+	append_long_name(destino, 'd');
+	assert(rename(archivo, destino) == 0 && access(destino, F_OK) == 0 &&
+	               access(archivo, F_OK) != 0,
+	       "rename con nombres largos dentro del mismo directorio");
+	snprintf(otro_dir, sizeof(otro_dir), "%s", TEST_ROOT);
+	append_long_name(otro_dir, 'e');
+	mkdir(otro_dir, DIR_PERM);
+	strcpy(archivo, otro_dir);
+	append_long_name(archivo, 'f');
+	assert(rename(destino, archivo) == 0 && access(archivo, F_OK) == 0,
+	       "rename con nombres largos entre directorios");
+
+	strcpy(destino, sub);
+	size_t len = strlen(destino);
+	destino[len] = '/';
+	memset(destino + len + 1, 'g', MAX_NAME_LEN + 1);
+	destino[len + MAX_NAME_LEN + 2] = STRING_END;
+	assert(rename(archivo, destino) != 0 && errno == ENAMETOOLONG,
+	       "un nombre más largo que MAX_NAME_LEN no se acepta");
+	unlink(archivo);
+	rmdir(otro_dir);
+	rmdir(sub);
+	rmdir(dir);
+}
+
+// RENAME_NOREPLACE and RENAME_EXCHANGE don't get through libfuse 2.9, so
+// they are tried on the filesystem of this process
+void
+test_fs_rename_flags()
+{
+	head("Tests rename con flags (núcleo)");
+	int uno = fs_create_entry("/uno", __S_IFREG | MODE_0644, FILE_TYPE);
+	int dos = fs_create_entry("/dos", __S_IFREG | MODE_0644, FILE_TYPE);
+	assert(uno >= 0 && dos >= 0, "se crean dos archivos");
+	assert(fs_rename(uno, ROOT_INDEX, "dos", RENAME_NOREPLACE) == -EEXIST,
+	       "RENAME_NOREPLACE no reemplaza un archivo existente");
+	assert(fs_lookup("/uno") == uno && fs_lookup("/dos") == dos,
+	       "los dos archivos siguen en su lugar");
+	assert(fs_rename(uno, ROOT_INDEX, "tres", RENAME_NOREPLACE) == 0,
+	       "RENAME_NOREPLACE mueve a un nombre libre");
+	assert(fs_rename(uno, ROOT_INDEX, "dos", RENAME_EXCHANGE) == 0,
+	       "RENAME_EXCHANGE intercambia dos archivos");
+	assert(fs_lookup("/dos") == uno && fs_lookup("/tres") == dos,
+	       "cada nombre apunta al otro archivo");
+	assert(fs_rename(uno, ROOT_INDEX, "cuatro", RENAME_EXCHANGE) == -ENOENT,
+	       "RENAME_EXCHANGE necesita que el destino exista");
+	assert(fs_rename(uno, ROOT_INDEX, "tres", RENAME_NOREPLACE | RENAME_EXCHANGE) ==
+	               -EINVAL,
+	       "RENAME_NOREPLACE y RENAME_EXCHANGE juntos son inválidos");
 }
 
 /*---------------------PRUEBAS CHALLENGES---------------------*/
@@ -346,6 +841,427 @@ test_fisopfs_chown()
 	unlink(path);
 }
 
+/*---------------------PRUEBAS DE PERSISTENCIA---------------------*/
+
+// Remove the image of REMOUNT_POINT, everything fisopfs leaves next to it
+// and the mount point
+void
+remove_image()
+{
+	static const char *sufijos[] = { "", ".journal", ".journal.old", ".tmp", ".blocks" };
+	char path[MAX_PATH_NAME];
+	for (size_t i = 0; i < sizeof(sufijos) / sizeof(sufijos[0]); i++) {
+		snprintf(path, sizeof(path), "%s%s", REMOUNT_DISK, sufijos[i]);
+		unlink(path);
+	}
+	rmdir(REMOUNT_POINT);
+}
+
+// Whether a fisopfs is mounted on REMOUNT_POINT, its device differs from
+// the one of the directory that holds it
+bool
+remounted()
+{
+	struct stat padre, montado;
+	return stat(".", &padre) == 0 && stat(REMOUNT_POINT, &montado) == 0 &&
+	       padre.st_dev != montado.st_dev;
+}
+
+// Run FISOPFS_BIN in the foreground on REMOUNT_POINT with REMOUNT_DISK and
+// the options, a NULL terminated list, and wait until it is mounted
+bool
+mount_fisopfs(char *options[])
+{
+	mkdir(REMOUNT_POINT, DIR_PERM);
+	char *args[MAX_MOUNT_ARGS] = {
+		FISOPFS_BIN, REMOUNT_POINT, "-f", "--filedisk", REMOUNT_DISK
+	};
+	int n = 5;
+	for (int i = 0; options[i] != NULL && n < MAX_MOUNT_ARGS - 1; i++)
+		args[n++] = options[i];
+	args[n] = NULL;
+	fisopfs_pid = fork();
+	if (fisopfs_pid == 0) {
+		// Its logs would get mixed with the results
+		int null_fd = open("/dev/null", O_WRONLY);
+		dup2(null_fd, STDOUT_FILENO);
+		dup2(null_fd, STDERR_FILENO);
+		execv(FISOPFS_BIN, args);
+		_exit(EXIT_FAILURE);
+	}
+	for (int esperado = 0; !remounted(); esperado += MOUNT_POLL_US) {
+		if (fisopfs_pid < 0 || waitpid(fisopfs_pid, NULL, WNOHANG) != 0 ||
+		    esperado > MOUNT_TIMEOUT_US) {
+			if (fisopfs_pid > 0) {
+				kill(fisopfs_pid, SIGKILL);
+				waitpid(fisopfs_pid, NULL, 0);
+			}
+			fisopfs_pid = -1;
+			return false;
+		}
+		usleep(MOUNT_POLL_US);
+	}
+	return true;
+}
+
+// Unmount REMOUNT_POINT and wait for fisopfs to write its image, or with
+// crash kill it first, so that only what reached the journal is left
+void
+unmount_fisopfs(bool crash)
+{
+	if (fisopfs_pid < 0)
+		return;
+	if (crash) {
+		kill(fisopfs_pid, SIGKILL);
+		waitpid(fisopfs_pid, NULL, 0);
+	}
+	pid_t pid = fork();
+	if (pid == 0) {
+		execlp(FUSERMOUNT, FUSERMOUNT, "-u", REMOUNT_POINT, (char *) NULL);
+		_exit(EXIT_FAILURE);
+	}
+	waitpid(pid, NULL, 0);
+	if (!crash)
+		waitpid(fisopfs_pid, NULL, 0);
+	fisopfs_pid = -1;
+}
+
+void
+test_fisopfs_rename_remount()
+{
+	head("Tests rename persiste al remontar");
+	char *opciones[] = { NULL };
+	remove_image();
+	assert(mount_fisopfs(opciones), "fisopfs se monta");
+	char dir[MAX_PATH_NAME], archivo[MAX_PATH_NAME];
+	snprintf(dir, sizeof(dir), "%s/dir", REMOUNT_POINT);
+	snprintf(archivo, sizeof(archivo), "%s/dir/archivo", REMOUNT_POINT);
+	mkdir(dir, DIR_PERM);
+	write_whole(archivo, "contenido", 9);
+	char dir_nuevo[MAX_PATH_NAME], archivo_nuevo[MAX_PATH_NAME];
+	snprintf(dir_nuevo, sizeof(dir_nuevo), "%s/movido", REMOUNT_POINT);
+	snprintf(archivo_nuevo, sizeof(archivo_nuevo), "%s/movido/renombrado", REMOUNT_POINT);
+	assert(rename(dir, dir_nuevo) == 0, "rename mueve el directorio");
+	snprintf(archivo, sizeof(archivo), "%s/movido/archivo", REMOUNT_POINT);
+	assert(rename(archivo, archivo_nuevo) == 0, "rename mueve el archivo");
+	unmount_fisopfs(false);
+	assert(mount_fisopfs(opciones), "fisopfs se vuelve a montar");
+	assert(has_contents(archivo_nuevo, "contenido", 9),
+	       "el archivo sigue con su nombre nuevo y su contenido");
+	assert(access(dir, F_OK) != 0 && access(archivo, F_OK) != 0,
+	       "los nombres viejos no vuelven");
+	unmount_fisopfs(false);
+
+	// The levels below each directory are counted again when loading
+	char profundo[MAX_PATH_NAME], destino[MAX_PATH_NAME];
+	snprintf(profundo, sizeof(profundo), "%s/movido/a", REMOUNT_POINT);
+	assert(mount_fisopfs(opciones), "fisopfs se monta otra vez");
+	mkdir(profundo, DIR_PERM);
+	snprintf(profundo, sizeof(profundo), "%s/movido/a/b", REMOUNT_POINT);
+	mkdir(profundo, DIR_PERM);
+	snprintf(destino, sizeof(destino), "%s/x", REMOUNT_POINT);
+	mkdir(destino, DIR_PERM);
+	snprintf(destino, sizeof(destino), "%s/x/y", REMOUNT_POINT);
+	mkdir(destino, DIR_PERM);
+	unmount_fisopfs(false);
+	assert(mount_fisopfs(opciones), "fisopfs se monta una vez más");
+	snprintf(destino, sizeof(destino), "%s/x/y/movido", REMOUNT_POINT);
+	assert(rename(dir_nuevo, destino) != 0 && errno == ENAMETOOLONG,
+	       "tras montar sigue sabiendo cuán profundo es un directorio");
+	unmount_fisopfs(false);
+	remove_image();
+}
+
+// Fill data with len bytes that differ from block to block, seed apart
+void
+fill_contents(char *data, size_t len, int seed)
+{
+	for (size_t i = 0; i < len; i++)
+		data[i] = (i * 7 + (i / FS_BLOCK_SIZE + seed) * 13) % 251;
+}
+
+// Write a file through fisopfs mounted with options and kill it before it
+// checkpoints, after syncing it with fsync or else just closing it
+void
+crash_and_replay(char *options[], bool sync, const char *titulo)
+{
+	head(titulo);
+	static char contenido[REMOUNT_FILE_SIZE];
+	fill_contents(contenido, sizeof(contenido), 0);
+	char archivo[MAX_PATH_NAME], dir[MAX_PATH_NAME], journal[MAX_PATH_NAME];
+	snprintf(archivo, sizeof(archivo), "%s/antes_del_corte", REMOUNT_POINT);
+	snprintf(dir, sizeof(dir), "%s/dir_antes_del_corte", REMOUNT_POINT);
+	snprintf(journal, sizeof(journal), "%s.journal", REMOUNT_DISK);
+	remove_image();
+	assert(mount_fisopfs(options), "fisopfs se monta");
+	mkdir(dir, DIR_PERM);
+	int fd = open(archivo, O_CREAT | O_WRONLY | O_TRUNC, MODE_0644);
+	write(fd, contenido, sizeof(contenido));
+	if (sync)
+		assert(fsync(fd) == 0, "fsync lleva el archivo al journal");
+	close(fd);
+	unmount_fisopfs(true);
+	struct stat st;
+	assert(stat(journal, &st) == 0 && st.st_size > 0,
+	       "el corte deja los cambios sólo en el journal");
+	char *sin_opciones[] = { NULL };
+	assert(mount_fisopfs(sin_opciones), "fisopfs se vuelve a montar");
+	assert(has_contents(archivo, contenido, sizeof(contenido)),
+	       "el archivo vuelve del journal con su contenido");
+	assert(stat(dir, &st) == 0 && S_ISDIR(st.st_mode),
+	       "el directorio vuelve del journal");
+	unmount_fisopfs(false);
+	remove_image();
+}
+
+// Whether every file written by remount_round_trip is back as it was
+bool
+round_trip_intact(const char *grande, const char *chico, const char *disperso)
+{
+	static char contenido[REMOUNT_FILE_SIZE], hueco[REMOUNT_FILE_SIZE];
+	fill_contents(contenido, sizeof(contenido), 0);
+	memset(hueco, 0, sizeof(hueco));
+	memcpy(hueco + sizeof(hueco) - 5, "final", 5);
+	return has_contents(grande, contenido, sizeof(contenido)) &&
+	       has_contents(chico, "chico", 5) &&
+	       has_contents(disperso, hueco, sizeof(hueco));
+}
+
+// Write a few files through fisopfs mounted with options and check they
+// come back after remounting. Then remount again having read only one of
+// them, so the others go from image to image without being loaded.
+void
+remount_round_trip(char *options[], const char *titulo)
+{
+	head(titulo);
+	static char contenido[REMOUNT_FILE_SIZE];
+	fill_contents(contenido, sizeof(contenido), 0);
+	char dir[MAX_PATH_NAME], grande[MAX_PATH_NAME], chico[MAX_PATH_NAME],
+	        disperso[MAX_PATH_NAME];
+	snprintf(dir, sizeof(dir), "%s/dir", REMOUNT_POINT);
+	snprintf(grande, sizeof(grande), "%s/dir/grande", REMOUNT_POINT);
+	snprintf(chico, sizeof(chico), "%s/chico", REMOUNT_POINT);
+	snprintf(disperso, sizeof(disperso), "%s/disperso", REMOUNT_POINT);
+	remove_image();
+	assert(mount_fisopfs(options), "fisopfs se monta");
+	mkdir(dir, DIR_PERM);
+	write_whole(grande, contenido, sizeof(contenido));
+	write_whole(chico, "chico", 5);
+	int fd = open(disperso, O_CREAT | O_WRONLY | O_TRUNC, MODE_0644);
+	pwrite(fd, "final", 5, REMOUNT_FILE_SIZE - 5);
+	close(fd);
+	assert(round_trip_intact(grande, chico, disperso),
+	       "los archivos se leen bien antes de desmontar");
+	unmount_fisopfs(false);
+	assert(mount_fisopfs(options), "fisopfs se vuelve a montar");
+	assert(has_contents(chico, "chico", 5), "el archivo chico vuelve igual");
+	unmount_fisopfs(false);
+	assert(mount_fisopfs(options), "fisopfs se monta por tercera vez");
+	assert(round_trip_intact(grande, chico, disperso),
+	       "los archivos no leídos pasan de una imagen a la otra");
+	unmount_fisopfs(false);
+	remove_image();
+}
+
+void
+test_fisopfs_remount()
+{
+	char *por_defecto[] = { NULL };
+	remount_round_trip(por_defecto, "Tests remontar");
+	char *mapeado[] = { "--mmap", NULL };
+	remount_round_trip(mapeado, "Tests remontar con --mmap");
+}
+
+void
+test_fisopfs_compress()
+{
+	char *comprimido[] = { "--compress", NULL };
+	remount_round_trip(comprimido, "Tests remontar con --compress");
+	head("Tests tamaño de la imagen con --compress");
+	static char texto[RANDOM_FILE_SIZE];
+	for (size_t i = 0; i < sizeof(texto); i++)
+		texto[i] = 'a' + i % 26;
+	char archivo[MAX_PATH_NAME];
+	snprintf(archivo, sizeof(archivo), "%s/texto", REMOUNT_POINT);
+	remove_image();
+	assert(mount_fisopfs(comprimido), "fisopfs se monta con --compress");
+	write_whole(archivo, texto, sizeof(texto));
+	unmount_fisopfs(false);
+	struct stat st;
+	assert(stat(REMOUNT_DISK, &st) == 0 && st.st_size < (off_t) sizeof(texto) / 4,
+	       "la imagen ocupa mucho menos que un archivo repetitivo");
+	assert(mount_fisopfs(comprimido), "fisopfs se vuelve a montar");
+	assert(has_contents(archivo, texto, sizeof(texto)),
+	       "el archivo se descomprime igual");
+	unmount_fisopfs(false);
+	remove_image();
+}
+
+// Counters of op in the statistics at path, false if it isn't listed
+bool
+stats_of(const char *path,
+         const char *op,
+         uintmax_t *calls,
+         uintmax_t *errors,
+         uintmax_t *bytes)
+{
+	FILE *f = fopen(path, "r");
+	if (f == NULL)
+		return false;
+	char linea[MAX_PATH_NAME], nombre[MAX_PATH_NAME];
+	bool encontrada = false;
+	while (!encontrada && fgets(linea, sizeof(linea), f) != NULL) {
+		int leidos = sscanf(
+		        linea, "%255s %ju %ju %ju", nombre, calls, errors, bytes);
+		encontrada = leidos == 4 && strcmp(nombre, op) == 0;
+	}
+	fclose(f);
+	return encontrada;
+}
+
+void
+test_fisopfs_stats_counts()
+{
+	head("Tests conteos de /.fisopfs_stats");
+	char *opciones[] = { NULL };
+	remove_image();
+	assert(mount_fisopfs(opciones), "fisopfs se monta");
+	char dir[MAX_PATH_NAME], archivo[MAX_PATH_NAME], stats[MAX_PATH_NAME];
+	for (int i = 0; i < STATS_DIRS; i++) {
+		snprintf(dir, sizeof(dir), "%s/dir%d", REMOUNT_POINT, i);
+		mkdir(dir, DIR_PERM);
+	}
+	snprintf(archivo, sizeof(archivo), "%s/dir0/archivo", REMOUNT_POINT);
+	static char contenido[STATS_WRITE_SIZE];
+	write_whole(archivo, contenido, sizeof(contenido));
+	snprintf(dir, sizeof(dir), "%s/dir0", REMOUNT_POINT);
+	rmdir(dir);  // Fails, it isn't empty
+	unlink(archivo);
+	for (int i = 0; i < STATS_DIRS; i++) {
+		snprintf(dir, sizeof(dir), "%s/dir%d", REMOUNT_POINT, i);
+		rmdir(dir);
+	}
+	snprintf(stats, sizeof(stats), "%s/%s", REMOUNT_POINT, STATS_FILE);
+	uintmax_t llamadas, errores, bytes;
+	assert(stats_of(stats, "mkdir", &llamadas, &errores, &bytes) &&
+	               llamadas == STATS_DIRS && errores == 0,
+	       "cuenta cada mkdir");
+	assert(stats_of(stats, "rmdir", &llamadas, &errores, &bytes) &&
+	               llamadas == STATS_DIRS + 1 && errores == 1,
+	       "cuenta cada rmdir y el que falló");
+	assert(stats_of(stats, "create", &llamadas, &errores, &bytes) && llamadas == 1,
+	       "cuenta el create");
+	assert(stats_of(stats, "write", &llamadas, &errores, &bytes) &&
+	               llamadas == 1 && bytes == STATS_WRITE_SIZE,
+	       "cuenta el write y sus bytes");
+	assert(stats_of(stats, "unlink", &llamadas, &errores, &bytes) && llamadas == 1,
+	       "cuenta el unlink");
+	unmount_fisopfs(false);
+	remove_image();
+}
+
+// Files of at most FS_INLINE_MAX bytes are kept inline, not in a block, on
+// a fisopfs of its own, since there is nothing inline with --mmap
+void
+test_fisopfs_inline()
+{
+	head("Tests archivos inline");
+	static char contenido[FS_INLINE_MAX + 1];
+	fill_contents(contenido, sizeof(contenido), 0);
+	char archivo[MAX_PATH_NAME];
+	snprintf(archivo, sizeof(archivo), "%s/inline", REMOUNT_POINT);
+	char *opciones[] = { NULL };
+	remove_image();
+	assert(mount_fisopfs(opciones), "fisopfs se monta");
+	int fd = open(archivo, O_CREAT | O_RDWR | O_EXCL, MODE_0644);
+	write(fd, contenido, FS_INLINE_MAX);
+	blkcnt_t bloques = blocks_of(fd);
+	assert(bloques > 0 && bloques < BLOCK_SECTORS,
+	       "hasta FS_INLINE_MAX bytes el archivo no ocupa un bloque");
+	write(fd, contenido + FS_INLINE_MAX, 1);
+	assert(blocks_of(fd) == BLOCK_SECTORS,
+	       "pasado FS_INLINE_MAX el contenido pasa a un bloque");
+	close(fd);
+	assert(has_contents(archivo, contenido, sizeof(contenido)),
+	       "el contenido sigue igual al pasar a un bloque");
+	truncate(archivo, FS_INLINE_MAX);
+	assert(has_contents(archivo, contenido, FS_INLINE_MAX),
+	       "truncar por debajo de FS_INLINE_MAX conserva el contenido");
+	fd = open(archivo, O_RDONLY);
+	assert(blocks_of(fd) == BLOCK_SECTORS, "truncado sigue usando su bloque");
+	close(fd);
+	unmount_fisopfs(false);
+	assert(mount_fisopfs(opciones), "fisopfs se vuelve a montar");
+	assert(has_contents(archivo, contenido, FS_INLINE_MAX),
+	       "el archivo truncado vuelve con su contenido");
+	fd = open(archivo, O_RDWR);
+	bloques = blocks_of(fd);
+	assert(bloques > 0 && bloques < BLOCK_SECTORS,
+	       "al cargarlo vuelve a quedar inline");
+	write(fd, contenido, sizeof(contenido));
+	assert(blocks_of(fd) == BLOCK_SECTORS, "y al crecer vuelve a un bloque");
+	close(fd);
+	assert(has_contents(archivo, contenido, sizeof(contenido)),
+	       "el contenido sigue igual");
+	unmount_fisopfs(false);
+	remove_image();
+}
+
+// Blocks in use in the filesystem mounted at path
+fsblkcnt_t
+used_blocks(const char *path)
+{
+	struct statvfs st;
+	return statvfs(path, &st) == 0 ? st.f_blocks - st.f_bfree : 0;
+}
+
+void
+test_fisopfs_dedup()
+{
+	char *dedup[] = { "--dedup", NULL };
+	remount_round_trip(dedup, "Tests remontar con --dedup");
+	head("Tests --dedup copia al escribir");
+	static char contenido[REMOUNT_FILE_SIZE], cambiado[REMOUNT_FILE_SIZE];
+	fill_contents(contenido, sizeof(contenido), 0);
+	memcpy(cambiado, contenido, sizeof(cambiado));
+	memset(cambiado + FS_BLOCK_SIZE, 'z', FS_BLOCK_SIZE);
+	char original[MAX_PATH_NAME], copia[MAX_PATH_NAME];
+	snprintf(original, sizeof(original), "%s/original", REMOUNT_POINT);
+	snprintf(copia, sizeof(copia), "%s/copia", REMOUNT_POINT);
+	remove_image();
+	assert(mount_fisopfs(dedup), "fisopfs se monta con --dedup");
+	write_whole(original, contenido, sizeof(contenido));
+	fsblkcnt_t usados = used_blocks(REMOUNT_POINT);
+	write_whole(copia, contenido, sizeof(contenido));
+	assert(used_blocks(REMOUNT_POINT) == usados,
+	       "dos archivos iguales comparten sus bloques");
+	int fd = open(copia, O_WRONLY);
+	pwrite(fd, cambiado + FS_BLOCK_SIZE, FS_BLOCK_SIZE, FS_BLOCK_SIZE);
+	close(fd);
+	assert(has_contents(copia, cambiado, sizeof(cambiado)),
+	       "el archivo sobrescrito tiene lo nuevo");
+	assert(has_contents(original, contenido, sizeof(contenido)),
+	       "el otro archivo no cambia");
+	assert(used_blocks(REMOUNT_POINT) == usados + 1,
+	       "sólo el bloque sobrescrito deja de compartirse");
+	unmount_fisopfs(false);
+	assert(mount_fisopfs(dedup), "fisopfs se vuelve a montar");
+	assert(has_contents(copia, cambiado, sizeof(cambiado)) &&
+	               has_contents(original, contenido, sizeof(contenido)),
+	       "los dos archivos vuelven como quedaron");
+	unmount_fisopfs(false);
+	remove_image();
+}
+
+void
+test_fisopfs_journal_replay()
+{
+	char *por_defecto[] = { NULL };
+	crash_and_replay(por_defecto, false, "Tests journal tras un corte (flush al cerrar)");
+	char *writeback[] = { "--writeback", NULL };
+	crash_and_replay(writeback, true, "Tests journal tras un corte (--writeback y fsync)");
+}
+
 int
 main()
 {
@@ -355,14 +1271,32 @@ main()
 	test_fisopfs_mkdir_and_rmdir();
 	test_fisopfs_getattr();
 	test_fisopfs_readdir();
+	test_fisopfs_readdir_paged();
 	test_fisopfs_create_unlink();
 	test_utimens();
+	test_fisopfs_relatime();
 	test_fisopfs_write_and_read();
+	test_fisopfs_large_file();
+	test_fisopfs_random_io();
+	test_fisopfs_fallocate();
+	test_fisopfs_statfs();
+	test_fisopfs_rename();
+	test_fisopfs_long_names();
+	test_fs_rename_flags();
 	head("----------------------------------");
 	head("=== TESTS DESAFÍOS DE FISOPFS ===");
 	test_fisopfs_mkdir_limit();
 	test_fisopfs_chown();
 	test_fisopfs_chmod();
+	head("----------------------------------");
+	head("=== TESTS DE PERSISTENCIA DE FISOPFS ===");
+	test_fisopfs_rename_remount();
+	test_fisopfs_remount();
+	test_fisopfs_compress();
+	test_fisopfs_stats_counts();
+	test_fisopfs_inline();
+	test_fisopfs_dedup();
+	test_fisopfs_journal_replay();
 	end_tests();
 	return 0;
 }
\ No newline at end of file